@@ -0,0 +1,222 @@
+/*
+ * This file contains the benchmark runner of the assembler, run by 'make bench'.
+ * It generates a fixed matrix of corpora with asmgen, times the assembler over each corpus
+ * and prints one JSON object per line with the lines per second and the peak resident set size,
+ * so the results of different commits can be compared line by line.
+ */
+
+/* wait4 reports the resource usage of a single child */
+#define _DEFAULT_SOURCE
+
+#include "utils.h"
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ASSEMBLER_PATH "./assembler"
+#define GENERATOR_PATH "./asmgen"
+#define BENCH_INPUT_DIR "input_files/bench"
+#define BENCH_OUTPUT_DIR "output_files/bench"
+#define BENCH_RUNS 3
+#define MAX_BENCH_ARGUMENTS 32
+
+/* Structure describing a corpus of the benchmark matrix and how it is assembled */
+struct bench_corpus {
+    const char *name;
+    int files;
+    int jobs;
+    const char *scale[MAX_BENCH_ARGUMENTS];
+};
+
+/* The benchmark matrix, every file of a corpus has the same scale and a seed of its own */
+static const struct bench_corpus bench_matrix[] = {
+    {"small", 200, 1, {"--lines", "50", NULL}},
+    {"medium", 200, 1, {"--lines", "200", "--labels", "40", "--macros", "4", "--externs", "10", "--entries", "10", NULL}},
+    {"large", 200, 1, {"--lines", "400", "--labels", "100", "--macros", "8", "--macro-lines", "4",
+                       "--externs", "20", "--entries", "20", "--data", "15", "--strings", "10", NULL}},
+    {"data_heavy", 200, 1, {"--lines", "300", "--data", "30", "--strings", "10", NULL}},
+    {"macro_heavy", 200, 1, {"--lines", "200", "--macros", "20", "--macro-lines", "6", "--macro-calls", "30", NULL}},
+    {"large_jobs4", 200, 4, {"--lines", "400", "--labels", "100", "--macros", "8", "--macro-lines", "4",
+                             "--externs", "20", "--entries", "20", "--data", "15", "--strings", "10", NULL}}
+};
+
+/* Function to read the monotonic wall clock in seconds */
+static double bench_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Function to run a program with its output discarded, returns its exit status and its peak resident set size in kilobytes */
+static int run_program(char **arguments, long *peak_rss) {
+    struct rusage usage;
+    pid_t child;
+    int descriptor;
+    int status;
+
+    fflush(stdout);
+    child = fork();
+    if (child < 0) {
+        fprintf(stderr, "Error: Unable to start %s\n", arguments[0]);
+        return ERROR;
+    }
+    if (child == 0) {
+        descriptor = open("/dev/null", O_WRONLY);
+        if (descriptor >= 0) {
+            dup2(descriptor, STDOUT_FILENO);
+            dup2(descriptor, STDERR_FILENO);
+        }
+        execv(arguments[0], arguments);
+        _exit(127);
+    }
+    if (wait4(child, &status, 0, &usage) != child || !WIFEXITED(status)) {
+        return ERROR;
+    }
+    *peak_rss = usage.ru_maxrss;
+    return WEXITSTATUS(status);
+}
+
+/* Function to count the lines of a generated file */
+static long count_lines(const char *path) {
+    FILE *file = fopen(path, MODE_READ);
+    long lines = 0;
+    int c;
+
+    if (file == NULL) {
+        return 0;
+    }
+    while ((c = getc(file)) != EOF) {
+        lines += c == '\n';
+    }
+    fclose(file);
+    return lines;
+}
+
+/* Function to generate the files of a corpus, returns their names as arguments of the assembler and counts their lines */
+static char **generate_corpus(const struct bench_corpus *corpus, long *lines) {
+    char *arguments[MAX_BENCH_ARGUMENTS + 4];
+    char **names;
+    char seed[32];
+    char path[MAX_PATH_LENGTH];
+    long peak_rss;
+    int count;
+    int i;
+
+    names = calloc(corpus->files + 1, sizeof(*names));
+    if (names == NULL) {
+        fprintf(stderr, "[ERROR] Out of memory, aborting.\n");
+        exit(1);
+    }
+
+    arguments[0] = GENERATOR_PATH;
+    for (count = 1; corpus->scale[count - 1] != NULL; count++) {
+        arguments[count] = (char *)corpus->scale[count - 1];
+    }
+    arguments[count] = "--seed";
+    arguments[count + 1] = seed;
+    arguments[count + 3] = NULL;
+
+    *lines = 0;
+    for (i = 0; i < corpus->files; i++) {
+        names[i] = malloc(MAX_PATH_LENGTH);
+        if (names[i] == NULL) {
+            fprintf(stderr, "[ERROR] Out of memory, aborting.\n");
+            exit(1);
+        }
+        sprintf(names[i], "%s/%s_%d", BENCH_INPUT_DIR, corpus->name, i);
+        sprintf(seed, "%d", i + 1);
+        arguments[count + 2] = names[i];
+        if (run_program(arguments, &peak_rss) != 0) {
+            fprintf(stderr, "Error: Failed to generate %s\n", names[i]);
+            exit(1);
+        }
+        sprintf(path, "%s%s", names[i], INPUT_FILE_EXT);
+        *lines += count_lines(path);
+    }
+    return names;
+}
+
+/* Function to time the assembler over a corpus and print its results as a line of JSON */
+static int bench_corpus(const struct bench_corpus *corpus, const char *label) {
+    char **arguments;
+    char **names;
+    char jobs[32];
+    double start;
+    double seconds;
+    double best = 0;
+    long peak_rss;
+    long max_rss = 0;
+    long lines;
+    int status = 0;
+    int run;
+    int i;
+
+    names = generate_corpus(corpus, &lines);
+    arguments = malloc((corpus->files + 5) * sizeof(*arguments));
+    if (arguments == NULL) {
+        fprintf(stderr, "[ERROR] Out of memory, aborting.\n");
+        exit(1);
+    }
+    sprintf(jobs, "%d", corpus->jobs);
+    arguments[0] = ASSEMBLER_PATH;
+    arguments[1] = "--no-am";
+    arguments[2] = "--jobs";
+    arguments[3] = jobs;
+    for (i = 0; i < corpus->files; i++) {
+        arguments[4 + i] = names[i];
+    }
+    arguments[4 + corpus->files] = NULL;
+
+    /* The best of the runs is reported, the peak memory is the largest of them.
+     * The assembler exits with a failure when any file fails, so a corpus that doesn't assemble is never timed */
+    for (run = 0; run < BENCH_RUNS && status == 0; run++) {
+        start = bench_clock();
+        if (run_program(arguments, &peak_rss) != 0) {
+            fprintf(stderr, "Error: The assembler failed on corpus %s\n", corpus->name);
+            status = ERROR;
+        }
+        seconds = bench_clock() - start;
+        best = run == 0 || seconds < best ? seconds : best;
+        max_rss = peak_rss > max_rss ? peak_rss : max_rss;
+    }
+
+    if (status == 0) {
+        printf("{\"label\": \"%s\", \"version\": \"%s\", \"corpus\": \"%s\", \"files\": %d, \"jobs\": %d, \"lines\": %ld, "
+               "\"runs\": %d, \"seconds\": %.6f, \"lines_per_second\": %.0f, \"peak_rss_kb\": %ld}\n",
+               label, ASSEMBLER_VERSION, corpus->name, corpus->files, corpus->jobs, lines,
+               BENCH_RUNS, best, best > 0 ? lines / best : 0.0, max_rss);
+        fflush(stdout);
+    }
+
+    for (i = 0; i < corpus->files; i++) {
+        free(names[i]);
+    }
+    free(names);
+    free(arguments);
+    return status;
+}
+
+/* Main function to run the whole benchmark matrix, an optional argument labels the results */
+int main(int argc, char **argv) {
+    const char *label = argc > 1 ? argv[1] : "";
+    int status = 0;
+    int i;
+
+    if (strchr(label, DOUBLE_QUOTE) != NULL || strchr(label, '\\') != NULL) {
+        fprintf(stderr, "Error: invalid label: '%s'\n", label);
+        return 1;
+    }
+    mkdir(BENCH_INPUT_DIR, 0777);
+    mkdir(OUTPUT_FILE_DIR, 0777);
+    mkdir(BENCH_OUTPUT_DIR, 0777);
+
+    for (i = 0; i < (int)(sizeof(bench_matrix) / sizeof(bench_matrix[0])); i++) {
+        status |= bench_corpus(&bench_matrix[i], label) != 0;
+    }
+    return status;
+}
@@ -0,0 +1,322 @@
+/*
+ * This file contains the program generator shipped with the assembler, used to build benchmark inputs.
+ * It writes a valid assembly program of a given scale: the number of lines, labels, macros and
+ * macro body lines, externals and entries, and the share of .data and .string lines are all set
+ * on the command line. The same options and seed always produce the same program.
+ * A program must still fit the code and data images, a scale that doesn't fit is rejected.
+ */
+
+#include "utils.h"
+
+/* Bounds of the values written in the generated operands and data */
+#define GENERATED_VALUE_RANGE 1000
+#define MAX_GENERATED_DATA_VALUES 6
+#define MIN_GENERATED_STRING_LENGTH 4
+#define MAX_GENERATED_STRING_LENGTH 20
+#define NUMBER_OF_REGISTERS 8
+
+/* Structure holding the scale of the generated program */
+struct generator_options {
+    long lines;
+    long labels;
+    long macros;
+    long macro_lines;
+    long macro_calls;
+    long externs;
+    long entries;
+    long data_percent;
+    long string_percent;
+    unsigned long seed;
+};
+
+/* Structure holding the state of the program being written */
+struct generator_state {
+    FILE *file;
+    unsigned long random;
+    const struct generator_options *options;
+    long code_words;
+    long data_words;
+    long *external_references;
+};
+
+/* Function to draw the next pseudo random number below a bound, the sequence depends on the seed only */
+static long next_random(struct generator_state *state, long bound) {
+    state->random = (state->random * 1103515245UL + 12345UL) & 0x7FFFFFFFUL;
+    return (long)((state->random >> 8) % (unsigned long)bound);
+}
+
+/* Function to write the name of a label an operand refers to, a local label or an external */
+static void write_label_operand(struct generator_state *state) {
+    long index;
+
+    /* An external is referred to only while its references fit the externals table */
+    if (state->options->externs > 0 && next_random(state, 4) == 0) {
+        index = next_random(state, state->options->externs);
+        if (state->external_references[index] < MAX_EXTERNAL_ADDRESSES) {
+            state->external_references[index]++;
+            fprintf(state->file, "X%ld", index);
+            return;
+        }
+    }
+    fprintf(state->file, "L%ld", next_random(state, state->options->labels));
+}
+
+/* Function to write an instruction, returns the number of code words it takes */
+static int write_instruction(struct generator_state *state) {
+    long value = next_random(state, 2 * GENERATED_VALUE_RANGE) - GENERATED_VALUE_RANGE;
+    long first = next_random(state, NUMBER_OF_REGISTERS);
+    long second = next_random(state, NUMBER_OF_REGISTERS);
+    long kind = next_random(state, state->options->labels > 0 ? 16 : 6);
+    FILE *file = state->file;
+
+    /* The first kinds use registers and immediates only, the others refer to labels */
+    switch (kind) {
+        case 0: fprintf(file, "mov #%ld, r%ld\n", value, first); return 2;
+        case 1: fprintf(file, "mov r%ld, *r%ld\n", first, second); return 2;
+        case 2: fprintf(file, "add r%ld, r%ld\n", first, second); return 2;
+        case 3: fprintf(file, "inc r%ld\n", first); return 2;
+        case 4: fprintf(file, "prn #%ld\n", value); return 2;
+        case 5: fprintf(file, "rts\n"); return 1;
+        case 6: fprintf(file, "cmp "); write_label_operand(state); fprintf(file, ", #%ld\n", value); return 3;
+        case 7: fprintf(file, "sub r%ld, ", first); write_label_operand(state); fprintf(file, "\n"); return 3;
+        case 8: fprintf(file, "lea "); write_label_operand(state); fprintf(file, ", *r%ld\n", first); return 3;
+        case 9: fprintf(file, "add "); write_label_operand(state); fprintf(file, ", r%ld\n", first); return 3;
+        case 10: fprintf(file, "clr "); write_label_operand(state); fprintf(file, "\n"); return 2;
+        case 11: fprintf(file, "dec "); write_label_operand(state); fprintf(file, "\n"); return 2;
+        case 12: fprintf(file, "jmp "); write_label_operand(state); fprintf(file, "\n"); return 2;
+        case 13: fprintf(file, "bne "); write_label_operand(state); fprintf(file, "\n"); return 2;
+        case 14: fprintf(file, "jsr "); write_label_operand(state); fprintf(file, "\n"); return 2;
+        default: fprintf(file, "mov "); write_label_operand(state); fprintf(file, ", r%ld\n", first); return 3;
+    }
+}
+
+/* Function to write a .data line, returns the number of data words it takes */
+static int write_data(struct generator_state *state) {
+    long count = 1 + next_random(state, MAX_GENERATED_DATA_VALUES);
+    long i;
+
+    fprintf(state->file, ".data ");
+    for (i = 0; i < count; i++) {
+        fprintf(state->file, "%s%ld", i > 0 ? ", " : "", next_random(state, 2 * GENERATED_VALUE_RANGE) - GENERATED_VALUE_RANGE);
+    }
+    fprintf(state->file, "\n");
+    return count;
+}
+
+/* Function to write a .string line, returns the number of data words it takes */
+static int write_string(struct generator_state *state) {
+    long length = MIN_GENERATED_STRING_LENGTH + next_random(state, MAX_GENERATED_STRING_LENGTH - MIN_GENERATED_STRING_LENGTH + 1);
+    long i;
+
+    fprintf(state->file, ".string \"");
+    for (i = 0; i < length; i++) {
+        fputc('a' + next_random(state, 26), state->file);
+    }
+    fprintf(state->file, "\"\n");
+    return length + 1;
+}
+
+/* Function to write the whole program, returns ERROR when it doesn't fit the code and data images */
+static int write_program(struct generator_state *state) {
+    const struct generator_options *options = state->options;
+    long *macro_words;
+    long call_spacing;
+    long next_call;
+    long calls_left = options->macro_calls;
+    long next_label = 0;
+    long line;
+    long roll;
+    long i;
+    long j;
+
+    macro_words = calloc(options->macros + 1, sizeof(*macro_words));
+    if (macro_words == NULL) {
+        fprintf(stderr, "[ERROR] Out of memory, aborting.\n");
+        exit(1);
+    }
+
+    /* Externals and entries head the program, entries name evenly spread labels */
+    for (i = 0; i < options->externs; i++) {
+        fprintf(state->file, ".extern X%ld\n", i);
+    }
+    for (i = 0; i < options->entries; i++) {
+        fprintf(state->file, ".entry L%ld\n", i * options->labels / options->entries);
+    }
+
+    /* Macro bodies are written once, their words are counted at every call */
+    for (i = 0; i < options->macros; i++) {
+        fprintf(state->file, "macr M%ld\n", i);
+        for (j = 0; j < options->macro_lines; j++) {
+            macro_words[i] += write_instruction(state);
+        }
+        fprintf(state->file, "endmacr\n");
+    }
+
+    /* Statement lines, labels and macro calls are spread evenly and the last line stops the program */
+    call_spacing = calls_left > 0 ? options->lines / (calls_left + 1) : 0;
+    next_call = call_spacing;
+    for (line = 0; line < options->lines; line++) {
+        if ((line * options->labels) % options->lines < options->labels) {
+            fprintf(state->file, "L%ld: ", next_label++);
+        } else if (calls_left > 0 && line >= next_call && line < options->lines - 1) {
+            /* A call can't be labeled, a call falling on a labeled line moves to the next one */
+            i = (options->macro_calls - calls_left--) % options->macros;
+            fprintf(state->file, "M%ld\n", i);
+            state->code_words += macro_words[i];
+            next_call += call_spacing;
+            continue;
+        }
+
+        roll = next_random(state, 100);
+        if (line == options->lines - 1) {
+            fprintf(state->file, "stop\n");
+            state->code_words++;
+        } else if (roll < options->data_percent) {
+            state->data_words += write_data(state);
+        } else if (roll < options->data_percent + options->string_percent) {
+            state->data_words += write_string(state);
+        } else {
+            state->code_words += write_instruction(state);
+        }
+    }
+
+    free(macro_words);
+    if (state->code_words > MAX_CODE_SIZE || state->data_words > MAX_DATA_SIZE) {
+        fprintf(stderr, "Error: the program takes %ld code words and %ld data words, the images hold %d and %d\n",
+                state->code_words, state->data_words, MAX_CODE_SIZE, MAX_DATA_SIZE);
+        return ERROR;
+    }
+    return 0;
+}
+
+/* Function to read the value of a numeric option */
+static int read_option_value(int argc, char **argv, int *i, long *value) {
+    char *end_ptr;
+
+    if (*i + 1 >= argc) {
+        fprintf(stderr, "Error: %s requires a number\n", argv[*i]);
+        return ERROR;
+    }
+    (*i)++;
+    *value = strtol(argv[*i], &end_ptr, 10);
+    if (end_ptr == argv[*i] || *end_ptr != '\0' || *value < 0) {
+        fprintf(stderr, "Error: invalid number: '%s'\n", argv[*i]);
+        return ERROR;
+    }
+    return 0;
+}
+
+/* Function to read the options of the generator, returns ERROR on a bad option or an inconsistent scale */
+static int parse_generator_arguments(int argc, char **argv, struct generator_options *options, char **base_name) {
+    static const char *names[] = {"--lines", "--labels", "--macros", "--macro-lines", "--macro-calls",
+                                  "--externs", "--entries", "--data", "--strings", "--seed"};
+    long *values[10];
+    long seed = 1;
+    int labels_given = 0;
+    int calls_given = 0;
+    int i;
+    int j;
+
+    values[0] = &options->lines;
+    values[1] = &options->labels;
+    values[2] = &options->macros;
+    values[3] = &options->macro_lines;
+    values[4] = &options->macro_calls;
+    values[5] = &options->externs;
+    values[6] = &options->entries;
+    values[7] = &options->data_percent;
+    values[8] = &options->string_percent;
+    values[9] = &seed;
+
+    options->lines = 200;
+    options->macros = 2;
+    options->macro_lines = 3;
+    options->externs = 2;
+    options->entries = 2;
+    options->data_percent = 10;
+    options->string_percent = 5;
+    *base_name = NULL;
+
+    for (i = 1; i < argc; i++) {
+        for (j = 0; j < 10 && strcmp(argv[i], names[j]) != 0; j++);
+        if (j < 10) {
+            if (read_option_value(argc, argv, &i, values[j]) != 0) {
+                return ERROR;
+            }
+            labels_given |= j == 1;
+            calls_given |= j == 4;
+        } else if (argv[i][0] == '-' || *base_name != NULL) {
+            fprintf(stderr, "Error: unexpected argument: '%s'\n", argv[i]);
+            return ERROR;
+        } else {
+            *base_name = argv[i];
+        }
+    }
+    options->seed = seed;
+
+    /* By default a tenth of the lines are labeled and every macro is called twice */
+    if (!labels_given) {
+        options->labels = options->lines / 10 > options->entries ? options->lines / 10 : options->entries;
+    }
+    if (!calls_given) {
+        options->macro_calls = 2 * options->macros;
+    }
+
+    if (*base_name == NULL || options->lines < 1) {
+        fprintf(stderr, "Error: a file name and at least one line are required\n");
+        return ERROR;
+    }
+    if (options->labels > options->lines || options->entries > options->labels ||
+        options->externs > MAX_EXTERNALS || options->data_percent + options->string_percent > 100 ||
+        (options->macro_calls > 0 && options->macros == 0) || options->macro_calls >= options->lines) {
+        fprintf(stderr, "Error: inconsistent program scale\n");
+        return ERROR;
+    }
+    return 0;
+}
+
+/* Main function to write the program base_name.as for the scale given on the command line */
+int main(int argc, char **argv) {
+    struct generator_options options;
+    struct generator_state state;
+    char *base_name;
+    char *path;
+    int result;
+
+    if (parse_generator_arguments(argc, argv, &options, &base_name) != 0) {
+        fprintf(stderr, "Usage: %s [--lines N] [--labels N] [--macros N] [--macro-lines N] [--macro-calls N] "
+                        "[--externs N] [--entries N] [--data PERCENT] [--strings PERCENT] [--seed N] file\n", argv[0]);
+        return 1;
+    }
+
+    path = malloc(strlen(base_name) + strlen(INPUT_FILE_EXT) + 1);
+    state.external_references = calloc(options.externs + 1, sizeof(*state.external_references));
+    if (path == NULL || state.external_references == NULL) {
+        fprintf(stderr, "[ERROR] Out of memory, aborting.\n");
+        exit(1);
+    }
+    strcpy(path, base_name);
+    strcat(path, INPUT_FILE_EXT);
+
+    state.file = fopen(path, MODE_WRITE);
+    if (state.file == NULL) {
+        fprintf(stderr, "Error: Unable to create file: %s\n", path);
+        free(path);
+        free(state.external_references);
+        return 1;
+    }
+    state.random = options.seed;
+    state.options = &options;
+    state.code_words = 0;
+    state.data_words = 0;
+
+    result = write_program(&state);
+    fclose(state.file);
+    if (result != 0) {
+        remove(path);
+    }
+
+    free(path);
+    free(state.external_references);
+    return result != 0;
+}
@@ -0,0 +1,354 @@
+/*
+ * This file implements the build cache of the assembler.
+ * A cache entry starts with a header line naming the assembler version and build, the output options and the file,
+ * then the length and the bytes of the source it was built from, then one section per output file or run of diagnostics, each made
+ * of a line with its kind and length followed by its bytes, and ends with a line holding the result.
+ * Entries are written to a temporary file and renamed into place, so a reader never sees a partial entry.
+ */
+
+#include "build_cache.h"
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/* Section kinds of a cache entry */
+#define SECTION_AM 'a'
+#define SECTION_OBJECT 'o'
+#define SECTION_ENTRIES 'n'
+#define SECTION_EXTERNALS 'x'
+#define SECTION_STDOUT 'O'
+#define SECTION_STDERR 'E'
+#define SECTION_RESULT 'r'
+
+/* Path of the executable of the running process */
+#define SELF_EXECUTABLE_PATH "/proc/self/exe"
+
+/* Statistics of the cache lookups of the run, shared by the worker threads */
+static int cache_hits = 0;
+static int cache_misses = 0;
+static int temporary_counter = 0;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Hash of the running assembler executable, entries written by any other build never match it */
+static unsigned long build_hash = 0;
+static bool build_hash_known = false;
+static pthread_once_t build_hash_once = PTHREAD_ONCE_INIT;
+
+/* Function to read a whole file into a new buffer, returns NULL when it can't be read */
+static char *read_whole_file(const char *path, long *length) {
+    FILE *file;
+    char *buffer;
+
+    file = fopen(path, MODE_READ);
+    if (file == NULL) {
+        return NULL;
+    }
+    if (fseek(file, 0, SEEK_END) != 0 || (*length = ftell(file)) < 0 || fseek(file, 0, SEEK_SET) != 0) {
+        fclose(file);
+        return NULL;
+    }
+    buffer = malloc(*length + 1);
+    if (buffer == NULL) {
+        fprintf(stderr, "[ERROR] Out of memory, aborting.\n");
+        exit(1);
+    }
+    if (fread(buffer, 1, *length, file) != (size_t)*length) {
+        free(buffer);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+    return buffer;
+}
+
+/* Function to hash the executable of the running assembler, runs once */
+static void compute_build_hash(void) {
+    char *image;
+    long length;
+
+    image = read_whole_file(SELF_EXECUTABLE_PATH, &length);
+    if (image != NULL) {
+        build_hash = hash_bytes(HASH_SEED, image, length);
+        build_hash_known = true;
+        free(image);
+    }
+}
+
+/* Function to build the path of an output of the assembly of a file, the same path its writer uses */
+static char *output_path(const struct assembler_options *options, char *filename, int kind) {
+    char *path;
+
+    if (kind == SECTION_AM) {
+        path = malloc(strlen(filename) + strlen(UNPACKED_FILE_EXT) + 1);
+        if (path == NULL) {
+            fprintf(stderr, "[ERROR] Out of memory, aborting.\n");
+            exit(1);
+        }
+        strcpy(path, filename);
+        strcat(path, UNPACKED_FILE_EXT);
+        return path;
+    }
+    return getFilePath(OUTPUT_FILE_DIR, stripInputFilesPrefix(filename),
+                       kind == SECTION_ENTRIES ? ENT_FILE_TYPE :
+                       kind == SECTION_EXTERNALS ? EXT_FILE_TYPE :
+                       options->binary_object ? BINARY_OBJ_FILE_TYPE : OBJ_FILE_TYPE);
+}
+
+/* Function to read the next section of an entry, returns 0 when the entry ends or is malformed */
+static int next_section(const char *entry, long length, long *position, char *kind, const char **bytes, long *size) {
+    const char *line_end;
+    char line[MAX_LENGTH];
+
+    line_end = memchr(entry + *position, '\n', length - *position);
+    if (line_end == NULL || line_end - (entry + *position) >= (long)sizeof(line)) {
+        return 0;
+    }
+    memcpy(line, entry + *position, line_end - (entry + *position));
+    line[line_end - (entry + *position)] = '\0';
+    if (sscanf(line, "%c %ld", kind, size) != 2 || *size < 0) {
+        return 0;
+    }
+    *position = line_end + 1 - entry;
+    *bytes = entry + *position;
+
+    /* The result section has no bytes, its size is the result itself */
+    if (*kind != SECTION_RESULT) {
+        if (*size > length - *position) {
+            return 0;
+        }
+        *position += *size;
+    }
+    return 1;
+}
+
+/* Function to write a restored output, an output that is already up to date is left untouched */
+static void restore_output(const char *path, const char *bytes, long size) {
+    char *current;
+    long current_length;
+    FILE *file;
+
+    current = read_whole_file(path, &current_length);
+    if (current != NULL && current_length == size && memcmp(current, bytes, size) == 0) {
+        free(current);
+        return;
+    }
+    free(current);
+
+    file = createFile(path);
+    if (file != NULL) {
+        fwrite(bytes, 1, size, file);
+        fclose(file);
+    }
+}
+
+/* Function to format the header of the entry of a source into a new buffer, it holds the whole key but the source */
+static char *format_header(const struct assembler_options *options, const char *filename, long length, int *header_length) {
+    char *header = malloc(strlen(CACHE_MAGIC) + strlen(ASSEMBLER_VERSION) + strlen(filename) + 80);
+
+    if (header == NULL) {
+        fprintf(stderr, "[ERROR] Out of memory, aborting.\n");
+        exit(1);
+    }
+    *header_length = sprintf(header, "%s %s %08lx %c%c %s\n%ld\n", CACHE_MAGIC, ASSEMBLER_VERSION, build_hash,
+                             options->write_am ? 'a' : '-', options->binary_object ? 'b' : 't', filename, length);
+    return header;
+}
+
+/* Function to count a cache lookup in the statistics of the run */
+static void count_lookup(int hit) {
+    pthread_mutex_lock(&cache_lock);
+    if (hit) {
+        cache_hits++;
+    } else {
+        cache_misses++;
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+/* Function to read the source of a file and compute its cache key.
+ * Returns ERROR when the source, or the assembler executable the key depends on, can't be read */
+int open_cache_source(const struct assembler_options *options, const char *filename, struct cache_source *source) {
+    char *path;
+    char flags[2];
+
+    memset(source, 0, sizeof(*source));
+    pthread_once(&build_hash_once, compute_build_hash);
+    if (!build_hash_known) {
+        return ERROR;
+    }
+
+    path = malloc(strlen(filename) + strlen(INPUT_FILE_EXT) + 1);
+    if (path == NULL) {
+        fprintf(stderr, "[ERROR] Out of memory, aborting.\n");
+        exit(1);
+    }
+    strcpy(path, filename);
+    strcat(path, INPUT_FILE_EXT);
+    source->text = read_whole_file(path, &source->length);
+    free(path);
+    if (source->text == NULL) {
+        return ERROR;
+    }
+
+    /* The key covers everything the outputs and diagnostics depend on, the build of the assembler included */
+    flags[0] = options->write_am ? 'a' : '-';
+    flags[1] = options->binary_object ? 'b' : 't';
+    source->hash = hash_bytes(HASH_SEED, ASSEMBLER_VERSION, strlen(ASSEMBLER_VERSION) + 1);
+    source->hash = hash_bytes(source->hash, (const char *)&build_hash, sizeof(build_hash));
+    source->hash = hash_bytes(source->hash, flags, sizeof(flags));
+    source->hash = hash_bytes(source->hash, filename, strlen(filename) + 1);
+    source->hash = hash_bytes(source->hash, source->text, source->length);
+
+    source->entry_path = malloc(strlen(options->cache_dir) + 1 + 8 + strlen(CACHE_FILE_TYPE) + 1);
+    if (source->entry_path == NULL) {
+        fprintf(stderr, "[ERROR] Out of memory, aborting.\n");
+        exit(1);
+    }
+    sprintf(source->entry_path, "%s/%08lx%s", options->cache_dir, source->hash, CACHE_FILE_TYPE);
+    return 0;
+}
+
+/* Function to restore the outputs and the diagnostics of a file from its cache entry.
+ * Returns 1 on a hit, with the result of the cached assembly, or 0 when the file must be assembled */
+int restore_cache_entry(const struct cache_source *source, const struct assembler_options *options, char *filename, int *result) {
+    char *header;
+    const char *bytes;
+    char *entry;
+    char *path;
+    long entry_length;
+    long position;
+    long size;
+    char kind = 0;
+    int header_length;
+
+    /* The entry must have been built by this version from the very same source */
+    entry = read_whole_file(source->entry_path, &entry_length);
+    header = format_header(options, filename, source->length, &header_length);
+    if (entry == NULL || entry_length < header_length + source->length ||
+        memcmp(entry, header, header_length) != 0 ||
+        memcmp(entry + header_length, source->text, source->length) != 0) {
+        free(header);
+        free(entry);
+        count_lookup(0);
+        return 0;
+    }
+
+    /* Check the whole entry before restoring anything from it */
+    position = header_length + source->length;
+    while (next_section(entry, entry_length, &position, &kind, &bytes, &size) && kind != SECTION_RESULT);
+    if (kind != SECTION_RESULT || position != entry_length) {
+        free(header);
+        free(entry);
+        count_lookup(0);
+        return 0;
+    }
+
+    /* Restore the outputs and replay the diagnostics in the order they were produced */
+    position = header_length + source->length;
+    while (next_section(entry, entry_length, &position, &kind, &bytes, &size)) {
+        if (kind == SECTION_RESULT) {
+            *result = size == 0 ? 0 : ERROR;
+            break;
+        } else if (kind == SECTION_STDOUT || kind == SECTION_STDERR) {
+            report_text(kind == SECTION_STDERR ? stderr : stdout, bytes, size);
+        } else {
+            path = output_path(options, filename, kind);
+            restore_output(path, bytes, size);
+            free(path);
+        }
+    }
+
+    free(header);
+    free(entry);
+    count_lookup(1);
+    return 1;
+}
+
+/* Function to write a section of a cache entry */
+static void write_section(FILE *file, char kind, const char *bytes, long size) {
+    fprintf(file, "%c %ld\n", kind, size);
+    fwrite(bytes, 1, size, file);
+}
+
+/* Function to store the outputs and the diagnostics of an assembly in the cache entry of its source.
+ * The cache is best effort, an entry that can't be written is simply skipped */
+void store_cache_entry(const struct cache_source *source, const struct assembler_options *options, char *filename,
+                       int outputs, const struct diagnostics *diagnostics, int result) {
+    static const int output_flags[] = {OUTPUT_AM, OUTPUT_OBJECT, OUTPUT_ENTRIES, OUTPUT_EXTERNALS};
+    static const char output_kinds[] = {SECTION_AM, SECTION_OBJECT, SECTION_ENTRIES, SECTION_EXTERNALS};
+    char *temporary_path;
+    char *header;
+    char *path;
+    char *bytes;
+    long size;
+    int header_length;
+    int failed = 0;
+    int i;
+    FILE *file;
+
+    mkdir(options->cache_dir, 0777);
+
+    /* Each entry is written under a name of its own and renamed into place */
+    temporary_path = malloc(strlen(source->entry_path) + 32);
+    if (temporary_path == NULL) {
+        fprintf(stderr, "[ERROR] Out of memory, aborting.\n");
+        exit(1);
+    }
+    pthread_mutex_lock(&cache_lock);
+    sprintf(temporary_path, "%s.%ld.%d.tmp", source->entry_path, (long)getpid(), temporary_counter++);
+    pthread_mutex_unlock(&cache_lock);
+
+    file = fopen(temporary_path, MODE_WRITE);
+    if (file == NULL) {
+        free(temporary_path);
+        return;
+    }
+    header = format_header(options, filename, source->length, &header_length);
+    fwrite(header, 1, header_length, file);
+    fwrite(source->text, 1, source->length, file);
+    free(header);
+
+    /* Store the outputs the assembly wrote */
+    for (i = 0; i < (int)sizeof(output_kinds); i++) {
+        if (outputs & output_flags[i]) {
+            path = output_path(options, filename, output_kinds[i]);
+            bytes = read_whole_file(path, &size);
+            free(path);
+            if (bytes == NULL) {
+                failed = 1;
+                break;
+            }
+            write_section(file, output_kinds[i], bytes, size);
+            free(bytes);
+        }
+    }
+
+    /* Store the diagnostics in the order they were reported */
+    for (i = 0; i < diagnostics->segments_count; i++) {
+        write_section(file, diagnostics->segments[i].stream == stderr ? SECTION_STDERR : SECTION_STDOUT,
+                      diagnostics->text + diagnostics->segments[i].offset, diagnostics->segments[i].length);
+    }
+    fprintf(file, "%c %d\n", SECTION_RESULT, result == 0 ? 0 : 1);
+
+    if (ferror(file)) {
+        failed = 1;
+    }
+    if (fclose(file) != 0 || failed || rename(temporary_path, source->entry_path) != 0) {
+        remove(temporary_path);
+    }
+    free(temporary_path);
+}
+
+/* Function to release the source read for a cache lookup */
+void close_cache_source(struct cache_source *source) {
+    free(source->text);
+    free(source->entry_path);
+    memset(source, 0, sizeof(*source));
+}
+
+/* Function to print the hit and miss counts of the cache lookups of the run */
+void print_cache_statistics(void) {
+    pthread_mutex_lock(&cache_lock);
+    printf("Cache: %d hits, %d misses\n", cache_hits, cache_misses);
+    pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,40 @@
+/*
+ * This header file declares the build cache of the assembler.
+ * A cache entry is keyed by a hash of the assembler version and executable, the output options,
+ * the file name and the contents of the .as file. It holds the source it was built from, the outputs and the
+ * diagnostics of the assembly, so an unchanged source is restored without running any pass.
+ */
+
+#ifndef BUILD_CACHE_H
+#define BUILD_CACHE_H
+
+/* Included necessary header file */
+#include "utils.h"
+
+/* Outputs written by the assembly of a file, recorded in its cache entry */
+#define OUTPUT_AM 1
+#define OUTPUT_OBJECT 2
+#define OUTPUT_ENTRIES 4
+#define OUTPUT_EXTERNALS 8
+#define OUTPUT_INCOMPLETE 16
+
+#define CACHE_MAGIC "ASMCACHE"
+#define CACHE_FILE_TYPE ".cache"
+
+/* Structure holding the source of a file looked up in the cache and the path of its entry */
+struct cache_source {
+    char *text;
+    long length;
+    unsigned long hash;
+    char *entry_path;
+};
+
+/* Function declarations */
+int open_cache_source(const struct assembler_options *options, const char *filename, struct cache_source *source);
+int restore_cache_entry(const struct cache_source *source, const struct assembler_options *options, char *filename, int *result);
+void store_cache_entry(const struct cache_source *source, const struct assembler_options *options, char *filename,
+                       int outputs, const struct diagnostics *diagnostics, int result);
+void close_cache_source(struct cache_source *source);
+void print_cache_statistics(void);
+
+#endif
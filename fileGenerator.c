@@ -8,63 +8,130 @@
 #include "fileGenerator.h"
 
 /* Function to create the object file containing the assembled machine code */
-int create_object_file(const int *assembly_code, const int assembly_code_size, const int *assembly_data, const int assembly_data_size, char *filename) {
+int create_object_file(const uint16_t *assembly_code, const int assembly_code_size, const uint16_t *assembly_data, const int assembly_data_size, char *filename) {
     char* obj_path;
     FILE* object_file;
-    int instruction_counter;
-    int i;
+    char* object_text;
+    struct object_image image = {0};
+    int length;
     const char* stripped_filename;
 
     /* Strip input file prefix and create the output file path */
     stripped_filename = stripInputFilesPrefix(filename);
     if (!stripped_filename) {
-        fprintf(stderr, "Error: Failed to strip input file prefix.\n");
+        report(stderr, "Error: Failed to strip input file prefix.\n");
         return ERROR;
     }
 
     obj_path = getFilePath(OUTPUT_FILE_DIR, stripped_filename, OBJ_FILE_TYPE);
     if (!obj_path) {
-        fprintf(stderr, "Error: Failed to create output file path.\n");
+        report(stderr, "Error: Failed to create output file path.\n");
         return ERROR;
     }
 
     object_file = createFile(obj_path);
     if (!object_file) {
-        fprintf(stderr, "Error: Failed to create object file.\n");
+        report(stderr, "Error: Failed to create object file.\n");
         free(obj_path);
         return ERROR;
     }
 
-    /* Write the sizes of code and data sections */
-    if (fprintf(object_file, "  %d %d\n", assembly_code_size, assembly_data_size) < 0) {
-        fprintf(stderr, "Error: Failed to write sizes to object file.\n");
+    /* Format the whole object file in memory and emit it with a single write */
+    image.base_address = INIT_ADDRESS;
+    image.code = assembly_code;
+    image.code_size = assembly_code_size;
+    image.data = assembly_data;
+    image.data_size = assembly_data_size;
+    object_text = format_text_object(&image, &length);
+    if (fwrite(object_text, 1, length, object_file) != (size_t)length) {
+        report(stderr, "Error: Failed to write object file.\n");
         fclose(object_file);
+        free(object_text);
         free(obj_path);
         return ERROR;
     }
 
-    instruction_counter = INIT_ADDRESS;
+    add_stat(counter_bytes_written, length);
+    free(object_text);
+    fclose(object_file);
+    free(obj_path);
+    return 0; /* Success */
+}
 
-    /* Write the code section */
-    for (i = 0; i < assembly_code_size; i++, instruction_counter++) {
-        if (writeInstruction(object_file, instruction_counter, assembly_code[i]) != 0) {
-            fprintf(stderr, "Error: Failed to write instruction to object file.\n");
-            fclose(object_file);
-            free(obj_path);
-            return ERROR;
-        }
+/* Function to create the binary object file holding the machine code with the entries and externals tables */
+int create_binary_object_file(const struct AssemblyUnit *unit, char *filename) {
+    char* obj_path;
+    FILE* object_file;
+    unsigned char* object_bytes;
+    struct object_image image = {0};
+    int length;
+    int i;
+    int j;
+    const char* stripped_filename;
+
+    /* Strip input file prefix and create the output file path */
+    stripped_filename = stripInputFilesPrefix(filename);
+    if (!stripped_filename) {
+        report(stderr, "Error: Failed to strip input file prefix.\n");
+        return ERROR;
     }
 
-    /* Write the data section */
-    for (i = 0; i < assembly_data_size; i++, instruction_counter++) {
-        if (writeInstruction(object_file, instruction_counter, assembly_data[i]) != 0) {
-            fprintf(stderr, "Error: Failed to write data to object file.\n");
-            fclose(object_file);
-            free(obj_path);
-            return ERROR;
+    obj_path = getFilePath(OUTPUT_FILE_DIR, stripped_filename, BINARY_OBJ_FILE_TYPE);
+    if (!obj_path) {
+        report(stderr, "Error: Failed to create output file path.\n");
+        return ERROR;
+    }
+
+    object_file = createFile(obj_path);
+    if (!object_file) {
+        report(stderr, "Error: Failed to create object file.\n");
+        free(obj_path);
+        return ERROR;
+    }
+
+    image.base_address = INIT_ADDRESS;
+    image.code = unit->code;
+    image.code_size = unit->code_size;
+    image.data = unit->data;
+    image.data_size = unit->data_size;
+
+    /* List the entries and the external references in the order of the .ent and .ext files */
+    image.entries = malloc((unit->entries_count + 1) * sizeof(*image.entries));
+    for (i = 0, j = 0; i < unit->externals_size; i++) {
+        j += unit->externals[i].address_count;
+    }
+    image.externals = malloc((j + 1) * sizeof(*image.externals));
+    if (image.entries == NULL || image.externals == NULL) {
+        fprintf(stderr, "[ERROR] Out of memory, aborting.\n");
+        exit(1);
+    }
+    for (i = unit->entries_count - 1; i >= 0; i--, image.entries_count++) {
+        strncpy(image.entries[image.entries_count].name, unit->entries[i]->symbol_name, OBJECT_NAME_LENGTH - 1);
+        image.entries[image.entries_count].name[OBJECT_NAME_LENGTH - 1] = '\0';
+        image.entries[image.entries_count].address = unit->entries[i]->symbol_address;
+    }
+    for (i = 0; i < unit->externals_size; i++) {
+        for (j = 0; j < unit->externals[i].address_count; j++, image.externals_count++) {
+            strncpy(image.externals[image.externals_count].name, unit->externals[i].external_symbol_name, OBJECT_NAME_LENGTH - 1);
+            image.externals[image.externals_count].name[OBJECT_NAME_LENGTH - 1] = '\0';
+            image.externals[image.externals_count].address = unit->externals[i].external_symbol_addresses[j];
         }
     }
 
+    /* Encode the whole object in memory and emit it with a single write */
+    object_bytes = encode_binary_object(&image, &length);
+    free(image.entries);
+    free(image.externals);
+    if (fwrite(object_bytes, 1, length, object_file) != (size_t)length) {
+        report(stderr, "Error: Failed to write object file.\n");
+        fclose(object_file);
+        free(object_bytes);
+        free(obj_path);
+        return ERROR;
+    }
+
+    add_stat(counter_bytes_written, length);
+    free(object_bytes);
     fclose(object_file);
     free(obj_path);
     return 0; /* Success */
@@ -80,19 +147,19 @@ int create_entry_file(const struct symbols_table *const entries[], const int ent
     /* Strip input file prefix and create the output file path */
     stripped_filename = stripInputFilesPrefix(filename);
     if (!stripped_filename) {
-        fprintf(stderr, "Error: Failed to strip input file prefix.\n");
+        report(stderr, "Error: Failed to strip input file prefix.\n");
         return ERROR;
     }
 
     ent_path = getFilePath(OUTPUT_FILE_DIR, stripped_filename, ENT_FILE_TYPE);
     if (!ent_path) {
-        fprintf(stderr, "Error: Failed to create entry file path.\n");
+        report(stderr, "Error: Failed to create entry file path.\n");
         return ERROR;
     }
 
     entry_file = createFile(ent_path);
     if (!entry_file) {
-        fprintf(stderr, "Error: Failed to create entry file.\n");
+        report(stderr, "Error: Failed to create entry file.\n");
         free(ent_path);
         return ERROR;
     }
@@ -100,13 +167,14 @@ int create_entry_file(const struct symbols_table *const entries[], const int ent
     /* Write each entry symbol and its address */
     for (i = entries_count - 1; i >= 0; i--) {
         if (fprintf(entry_file, "%s:\t%d\n", entries[i]->symbol_name, entries[i]->symbol_address) < 0) {
-            fprintf(stderr, "Error: Failed to write entry to file.\n");
+            report(stderr, "Error: Failed to write entry to file.\n");
             fclose(entry_file);
             free(ent_path);
             return ERROR;
         }
     }
 
+    add_stat(counter_bytes_written, ftell(entry_file));
     fclose(entry_file);
     free(ent_path);
     return 0; /* Success */
@@ -123,19 +191,19 @@ int create_external_file(const struct external_symbols_table *externals, const i
     /* Strip input file prefix and create the output file path */
     stripped_filename = stripInputFilesPrefix(filename);
     if (!stripped_filename) {
-        fprintf(stderr, "Error: Failed to strip input file prefix.\n");
+        report(stderr, "Error: Failed to strip input file prefix.\n");
         return ERROR;
     }
 
     ext_path = getFilePath(OUTPUT_FILE_DIR, stripped_filename, EXT_FILE_TYPE);
     if (!ext_path) {
-        fprintf(stderr, "Error: Failed to create external file path.\n");
+        report(stderr, "Error: Failed to create external file path.\n");
         return ERROR;
     }
 
     external_file = createFile(ext_path);
     if (!external_file) {
-        fprintf(stderr, "Error: Failed to create external file.\n");
+        report(stderr, "Error: Failed to create external file.\n");
         free(ext_path);
         return ERROR;
     }
@@ -144,7 +212,7 @@ int create_external_file(const struct external_symbols_table *externals, const i
     for (i = 0; i < externals_count; i++) {
         for (j = 0; j < externals[i].address_count; j++) {
             if (fprintf(external_file, "%s\t%d\n", externals[i].external_symbol_name, externals[i].external_symbol_addresses[j]) < 0) {
-                fprintf(stderr, "Error: Failed to write external symbol to file.\n");
+                report(stderr, "Error: Failed to write external symbol to file.\n");
                 fclose(external_file);
                 free(ext_path);
                 return ERROR;
@@ -152,6 +220,7 @@ int create_external_file(const struct external_symbols_table *externals, const i
         }
     }
 
+    add_stat(counter_bytes_written, ftell(external_file));
     fclose(external_file);
     free(ext_path);
     return 0; /* Success with the right treatment */
@@ -8,5 +8,7 @@
 
 /* Included necessary header file */
 #include "utils.h"
+#include "object_format.h"
+#include "stats.h"
 
 #endif
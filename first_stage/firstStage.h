@@ -8,8 +8,28 @@
 /* Included header files */
 #include "../line_interpreter.h"
 #include "../utils.h"
+#include "../stats.h"
+#include "../worker_pool.h"
 
-/* Function prototype */
-int firstStage(struct AssemblyUnit* Unit, FILE *assembly_file, char *file_name);
+/* Structure representing a chunk of lines of a file, analyzed on a thread of its own.
+ * The offsets of a line count the code and data words of the lines before it in the chunk,
+ * the bases count the words of the chunks before it. */
+struct line_chunk {
+    const struct source_buffer *expanded;
+    int first_line;
+    int end_line;
+    struct line_memo memo;
+    int *analysis;
+    int *code_offset;
+    int *data_offset;
+    int code_words;
+    int data_words;
+    int code_base;
+    int data_base;
+};
+
+/* Function prototypes */
+int firstStage(struct AssemblyUnit* Unit, const struct source_buffer *expanded, char *file_name, int jobs);
+void record_line(struct AssemblyUnit* Unit, const struct analized_line *line, int line_counter, int word_offset);
 
 #endif 
@@ -1,6 +1,7 @@
 /*
  * This file implements the line interpreter for our assembly language processor.
  * It provides functionality to analyze and interpret individual lines of assembly code.
+ * Lines are scanned forward as spans of the caller's buffer, which is never copied or modified.
  * This module providing detailed analysis of each assembly instruction and preparing 
  * the data for the next stages of the assembly.
  */
@@ -8,15 +9,6 @@
 /* Included necesarry header file. */
 #include "line_interpreter.h"
 
-/* Global variable to store the current line being analyzed */
-struct analized_line current_line = {0};
-
-/* Structure to hold tokens from a string split by spaces */
-struct StringTokens {
-    char *string_tokens[80];
-    int token_count;
-};
-
 /* Structure to hold information about directives */
 struct DirectiveInfo {
     char * directive_name;
@@ -59,291 +51,322 @@ struct OperandInfo operand_table[NUMBER_OF_OPCODES] = {
     {NULL,"0123"}, {NULL,"12"}, {NULL,NULL}, {NULL,NULL},
 };
 
-/* Main function to analyze an assembly line */
-int analyze_assembly_line(char *assembly_line) {
-    struct OpcodeInfo *instruction;
-    struct DirectiveInfo *DirectiveInfo;
-    struct StringTokens space_tokens;
-    static char line_copy[82] = {0};
-    char *label_pos, *equal_pos, *text_pos;
-    char **current_token;
+/* Macros computing the template of an opcode with a source mode s and a destination mode d.
+ * The first word holds the opcode, a bit for each addressing mode and the A field,
+ * two register operands share a single extra word, any other operand takes a word of its own */
+#define IS_REGISTER_MODE(m) ((m) == INDIRECT || (m) == DIRECT)
+#define IS_REGISTER_PAIR(s, d) (IS_REGISTER_MODE(s) && IS_REGISTER_MODE(d))
+#define MODE_WORD(m) ((m) == IMMEDIATE ? extra_immediate : (m) == LABEL ? extra_label : \
+                      IS_REGISTER_MODE(m) ? extra_register : extra_none)
+#define FIRST_WORD(op, s, d) (((op) << 11) | ((s) != NONE ? 1 << ((s) + 7) : 0) | ((d) != NONE ? 1 << ((d) + 3) : 0) | 4)
+#define WORD_COUNT(s, d) (IS_REGISTER_PAIR(s, d) ? 2 : 1 + ((s) != NONE) + ((d) != NONE))
+#define TEMPLATE(op, s, d) {FIRST_WORD(op, s, d), WORD_COUNT(s, d), \
+    {IS_REGISTER_PAIR(s, d) ? extra_register_pair : (s) != NONE ? MODE_WORD(s) : MODE_WORD(d), \
+     IS_REGISTER_PAIR(s, d) || (s) == NONE ? extra_none : MODE_WORD(d)}, \
+    {(s) != NONE || IS_REGISTER_PAIR(s, d) ? 0 : 1, 1}}
+#define SOURCE_TEMPLATES(op, s) {TEMPLATE(op, s, NONE), TEMPLATE(op, s, IMMEDIATE), TEMPLATE(op, s, LABEL), \
+    TEMPLATE(op, s, INDIRECT), TEMPLATE(op, s, DIRECT)}
+#define OPCODE_TEMPLATES(op) {SOURCE_TEMPLATES(op, NONE), SOURCE_TEMPLATES(op, IMMEDIATE), \
+    SOURCE_TEMPLATES(op, LABEL), SOURCE_TEMPLATES(op, INDIRECT), SOURCE_TEMPLATES(op, DIRECT)}
+
+/* Array of the encoding templates indexed by opcode, source mode and destination mode */
+const struct instruction_template instruction_templates[NUMBER_OF_OPCODES][NUMBER_OF_MODES][NUMBER_OF_MODES] = {
+    OPCODE_TEMPLATES(opcode_mov), OPCODE_TEMPLATES(opcode_cmp), OPCODE_TEMPLATES(opcode_add), OPCODE_TEMPLATES(opcode_sub),
+    OPCODE_TEMPLATES(opcode_lea), OPCODE_TEMPLATES(opcode_clr), OPCODE_TEMPLATES(opcode_not), OPCODE_TEMPLATES(opcode_inc),
+    OPCODE_TEMPLATES(opcode_dec), OPCODE_TEMPLATES(opcode_jmp), OPCODE_TEMPLATES(opcode_bne), OPCODE_TEMPLATES(opcode_red),
+    OPCODE_TEMPLATES(opcode_prn), OPCODE_TEMPLATES(opcode_jsr), OPCODE_TEMPLATES(opcode_rts), OPCODE_TEMPLATES(opcode_stop),
+};
 
-    /* Initialize current_line structure and set default operand types to 'none' */
-    memset(&current_line, 0, sizeof(current_line));
-    current_line.operand_type[0] = none;
-    current_line.operand_type[1] = none;
+/* Structure to hold information about a reserved word, code is its opcode, directive, register or macro keyword number */
+struct KeywordInfo {
+    char * keyword_name;
+    int length;
+    keyword_kind kind;
+    int code;
+};
 
-    /* Skip leading whitespace characters */
-    while (isspace(*assembly_line)) assembly_line++;
+/* Array of all the reserved words of the language */
+struct KeywordInfo keyword_table[NUMBER_OF_KEYWORDS] = {
+    {"mov",3,keyword_opcode,opcode_mov}, {"cmp",3,keyword_opcode,opcode_cmp}, {"add",3,keyword_opcode,opcode_add},
+    {"sub",3,keyword_opcode,opcode_sub}, {"lea",3,keyword_opcode,opcode_lea}, {"clr",3,keyword_opcode,opcode_clr},
+    {"not",3,keyword_opcode,opcode_not}, {"inc",3,keyword_opcode,opcode_inc}, {"dec",3,keyword_opcode,opcode_dec},
+    {"jmp",3,keyword_opcode,opcode_jmp}, {"bne",3,keyword_opcode,opcode_bne}, {"red",3,keyword_opcode,opcode_red},
+    {"prn",3,keyword_opcode,opcode_prn}, {"jsr",3,keyword_opcode,opcode_jsr}, {"rts",3,keyword_opcode,opcode_rts},
+    {"stop",4,keyword_opcode,opcode_stop},
+    {".string",7,keyword_directive,0}, {".data",5,keyword_directive,1}, {".extern",7,keyword_directive,2},
+    {".entry",6,keyword_directive,3}, {".define",7,keyword_define,0},
+    {"r0",2,keyword_register,0}, {"r1",2,keyword_register,1}, {"r2",2,keyword_register,2}, {"r3",2,keyword_register,3},
+    {"r4",2,keyword_register,4}, {"r5",2,keyword_register,5}, {"r6",2,keyword_register,6}, {"r7",2,keyword_register,7},
+    {"macr",4,keyword_macro,0}, {"endmacr",7,keyword_macro,1},
+};
 
-    /* Remove trailing newline characters */
-    assembly_line[strcspn(assembly_line, "\r\n")] = 0; 
+/* Perfect hash of a word of MIN_KEYWORD_LENGTH or more characters, the multipliers were searched
+ * offline so that every reserved word falls in a different slot of keyword_slots */
+#define KEYWORD_HASH(word, length) \
+    (((length) * 4 + (unsigned char)(word)[1] * 30 + (unsigned char)(word)[(length) - 1] * 22 \
+      + (unsigned char)(word)[0]) & (KEYWORD_SLOTS - 1))
+
+/* keyword_table position of the reserved word hashed to each slot, -1 for an empty slot */
+static const signed char keyword_slots[KEYWORD_SLOTS] = {
+    10, -1, 19, -1, -1, -1, -1, -1, 8, -1, 25, -1, 12, -1, -1, -1,
+    17, -1, -1, -1, 18, 1, 24, -1, -1, -1, -1, 7, 9, -1, 16, 0,
+    -1, 3, 23, 5, 4, -1, 28, 29, -1, -1, -1, -1, 11, -1, 22, -1,
+    20, 30, 27, -1, 6, -1, -1, -1, 14, -1, 21, 15, 13, 2, 26, -1,
+};
 
-    /* Make a copy of the assembly line for manipulation */
-    strcpy(line_copy, assembly_line);
+/* Function to analyze a null terminated assembly line */
+int analyze_assembly_line(struct analized_line *current_line, const char *assembly_line) {
+    return analyze_line(assembly_line, strlen(assembly_line), current_line);
+}
 
-    /* Split the line by spaces */
-    space_tokens = split_by_spaces(assembly_line);
-    current_token = &space_tokens.string_tokens[0];
+/* Main function to analyze an assembly line of line_length characters into a caller-owned result */
+int analyze_line(const char *assembly_line, int line_length, struct analized_line *current_line) {
+    keyword_kind keyword;
+    int keyword_code;
+    struct line_token token;
+    const char *token_text;
+    const char *label_end;
+    int position;
 
-    /* Check if the first token is a label (contains ':') */
-    label_pos = strchr(*current_token, ':');
+    /* Initialize current_line structure and set default operand types to 'none' */
+    memset(current_line, 0, sizeof(*current_line));
+    current_line->operand_type[0] = none;
+    current_line->operand_type[1] = none;
+
+    /* Skip leading whitespace, the line then ends at the first newline or carriage return */
+    for (position = 0; position < line_length && isspace((unsigned char)assembly_line[position]); position++);
+    for (; position < line_length; position++) {
+        if (assembly_line[position] == '\n' || assembly_line[position] == '\r' || assembly_line[position] == '\0') {
+            break;
+        }
+    }
+    line_length = position;
 
-    if (label_pos) {
-        /* Validate and process the label */
-        *label_pos = '\0'; /* Terminate the string at ':' */
-        label_pos++;
+    if (!next_token(assembly_line, line_length, 0, &token)) {
+        sprintf(current_line->error, "Empty line");
+        return 0;
+    }
+    token_text = assembly_line + token.offset;
 
-        if (*label_pos != '\0') {
-            label_pos--;
-            *label_pos = ':'; /* Restore ':' if invalid label */
-            sprintf(current_line.error, "Error: invalid label:'%s'.", *current_token);
-            return ERROR;
-        }
+    /* Check if the first token is a label (contains ':') */
+    if (token.kind == token_label) {
+        label_end = memchr(token_text, ':', token.length);
 
-        /* Check if the label is valid */
-        if (validate_label(*current_token, 0) != 0) {
-            label_pos--;
-            *label_pos = ':'; /* Restore ':' if invalid label */
-            sprintf(current_line.error, "Error: invalid label:'%s'.", *current_token);
+        /* The ':' must end the token and follow a valid label */
+        if (label_end != token_text + token.length - 1 || validate_label(token_text, label_end - token_text, 0) != 0) {
+            sprintf(current_line->error, "Error: invalid label:'%.*s'.", token.length, token_text);
             return ERROR;
         }
 
         /* Assign the label to current_line */
-        current_line.label_name = *current_token;
-        current_token++;
-    }
+        current_line->label_name.text = token_text;
+        current_line->label_name.length = label_end - token_text;
 
-    /* If no tokens left after processing the label, report empty line */
-    if (*current_token == NULL) {
-        sprintf(current_line.error, "Empty line");
-        return 0;  
+        /* If no tokens left after processing the label, report empty line */
+        if (!next_token(assembly_line, line_length, token.offset + token.length, &token)) {
+            sprintf(current_line->error, "Empty line");
+            return 0;
+        }
+        token_text = assembly_line + token.offset;
     }
 
-    /* Check if the current token is an instruction */
-    instruction = find_instruction_by_name(*current_token);
-    if (instruction) {
-        struct OperandInfo *operand_info = &operand_table[instruction - opcode_table];
-        current_line.line_type = code_line;
-        current_token++;
+    /* Classify the current token once, it is an instruction, a directive or .define */
+    keyword = classify_keyword(token_text, token.length, &keyword_code);
+    if (keyword == keyword_opcode) {
+        struct OperandInfo *operand_info = &operand_table[keyword_code];
+        current_line->line_type = code_line;
 
         /* Check for missing or unexpected operands */
-        if (*current_token == NULL && operand_info->destination_operand != NULL) {
-            sprintf(current_line.error, "Error: missing operands");
-            return ERROR;
-        }
-        if (*current_token && operand_info->destination_operand == NULL) {
-            sprintf(current_line.error, "Error: extra operands");
-            return ERROR;
-        }
+        if (!next_token(assembly_line, line_length, token.offset + token.length, &token)) {
+            if (operand_info->destination_operand != NULL) {
+                sprintf(current_line->error, "Error: missing operands");
+                return ERROR;
+            }
+        } else {
+            if (operand_info->destination_operand == NULL) {
+                sprintf(current_line->error, "Error: extra operands");
+                return ERROR;
+            }
 
-        /* Parse operands if present */
-        if (*current_token) {
-            label_pos = &line_copy[0];
-            if (pre_analyze_operand(label_pos + ((*current_token) - space_tokens.string_tokens[0]), instruction, operand_info) != 0) {
+            /* Parse the operands, they span the rest of the line */
+            if (pre_analyze_operand(current_line, assembly_line + token.offset, line_length - token.offset, operand_info) != 0) {
                 return ERROR;  
             }
         }
 
         /* Set the opcode of the instruction */
-        current_line.opcode = instruction->opcode;
-    } else {
-        /* If not an instruction, check if it's a directive */
-        DirectiveInfo = find_directive_by_name(*current_token);
-        if (DirectiveInfo) {
-            current_token++;
-
-            /* Check for missing operands */
-            if (*current_token == NULL) {
-                sprintf(current_line.error, "Error: missing operands");
-                return ERROR;
-            }
+        current_line->opcode = opcode_table[keyword_code].opcode;
+        return 0;
+    }
 
-            /* Process the directive with its operands */
-            label_pos = &line_copy[0];
-            if (process_directive(label_pos + ((*current_token) - space_tokens.string_tokens[0]), DirectiveInfo) != 0) {
-                return ERROR; 
-            }
-            current_line.line_type = directive_line;
-        } else {
-            /* Check for a .define statement */
-            if (strcmp(".define", *current_token) == 0) {
-                current_token++;
-                label_pos = &line_copy[0] + ((*current_token) - space_tokens.string_tokens[0]);
-                equal_pos = strchr(label_pos, '=');
-
-                if (equal_pos) {
-                    *equal_pos = '\0'; /* Terminate string at '=' */
-                    text_pos = strpbrk(label_pos, WHITESPACE);
-
-                    if (text_pos) *text_pos = '\0'; /* Remove trailing spaces from label */
-
-                    equal_pos++;
-                    while (isspace(*equal_pos)) equal_pos++; /* Skip leading spaces */
-
-                    text_pos = strpbrk(equal_pos, WHITESPACE);
-                    if (text_pos) {
-                        *text_pos = '\0'; /* Terminate string at first space */
-                        text_pos++;
-                        while (isspace(*text_pos)) text_pos++; /* Skip leading spaces */
-
-                        if (*text_pos != '\0') {
-                            /* If extra text is found, report an error */
-                            sprintf(current_line.error, "Error: extra text:'%s'", text_pos);
-                            return ERROR;
-                        }
-                    }
-
-                    /* Validate label and number for .define */
-                    if (validate_label(label_pos, 0) == 0) {
-                        int validation_result = validate_number(equal_pos, &current_line.definition_count, MIN_NUM_RANGE, MAX_NUM_RANGE);
-                        current_line.line_type = definition_line;
-                        current_line.definition_label = label_pos;
-
-                        if (validation_result == 0) {
-                            /* Valid number, continue processing */
-                        } else if (validation_result == INVALID_VALUE) {
-                            sprintf(current_line.error, "Error: invalid number format: '%s'", equal_pos);
-                            return ERROR;
-                        } else if (validation_result == OUT_OF_RANGE) {
-                            sprintf(current_line.error, "Error: number out of range (-2048 to 2047): '%s'", equal_pos);
-                            return ERROR;
-                        } else {
-                            sprintf(current_line.error, "Unexpected error while processing: '%s'", equal_pos);
-                            return ERROR;
-                        }
-                    } else {
-                        sprintf(current_line.error, "Error: invalid label or no label found:'%s'", label_pos);
-                        return ERROR;
-                    }
-                } else {
-                    /* Report error if '=' is missing */
-                    sprintf(current_line.error, "Error: '=' was not found.");
-                    return ERROR;
-                }
-            } else {
-                /* Report error if the token is an undefined keyword */
-                sprintf(current_line.error, "Error: keyword:'%s' not recognized", *current_token);
-                return ERROR;
-            }
+    /* If not an instruction, check if it's a directive */
+    if (keyword == keyword_directive) {
+        /* Check for missing operands */
+        if (!next_token(assembly_line, line_length, token.offset + token.length, &token)) {
+            sprintf(current_line->error, "Error: missing operands");
+            return ERROR;
+        }
+
+        /* Process the directive with its operands */
+        if (process_directive(current_line, assembly_line + token.offset, line_length - token.offset, &directives_list[keyword_code]) != 0) {
+            return ERROR; 
+        }
+        current_line->line_type = directive_line;
+        return 0;
+    }
+
+    /* Check for a .define statement */
+    if (keyword == keyword_define) {
+        if (!next_token(assembly_line, line_length, token.offset + token.length, &token)) {
+            sprintf(current_line->error, "Error: '=' was not found.");
+            return ERROR;
         }
+        return process_define(current_line, assembly_line + token.offset, line_length - token.offset);
     }
 
-    return 0;  
+    /* Report error if the token is an undefined keyword */
+    sprintf(current_line->error, "Error: keyword:'%.*s' not recognized", token.length, token_text);
+    return ERROR;
+}
+
+/* Function to scan the next whitespace separated token starting at position, returns 0 at the end of the line */
+int next_token(const char *line, int line_length, int position, struct line_token *token) {
+    /* Skip leading whitespace */
+    while (position < line_length && isspace((unsigned char)line[position])) position++;
+    if (position >= line_length) {
+        return 0;
+    }
+
+    /* Classify the token while scanning it: a ':' makes it a label, a leading '.' a directive */
+    token->offset = position;
+    token->kind = line[position] == '.' ? token_directive : token_word;
+    while (position < line_length && !isspace((unsigned char)line[position])) {
+        if (line[position] == ':') {
+            token->kind = token_label;
+        }
+        position++;
+    }
+    token->length = position - token->offset;
+    return 1;
 }
 
 /* Function to validate a label */
-int validate_label(char *label_name, int brackets) {
-    int label_length = 0;
+int validate_label(const char *label_name, int length, int brackets) {
+    int i;
     /* Check if the first character is a letter */
-    if (!isalpha(*label_name)) {
+    if (length == 0 || !isalpha((unsigned char)label_name[0])) {
         return INVALID_VALUE;
     }
-    label_name++; 
-    label_length++;
     /* Check remaining characters */
-    while (*label_name) {
+    for (i = 1; i < length; i++) {
         /* If character is not alphanumeric and brackets are not allowed, return -1 */
-        if ((!isalnum(*label_name)) && brackets == 0) {
+        if ((!isalnum((unsigned char)label_name[i])) && brackets == 0) {
             return INVALID_VALUE;
         }
-        label_length++;
-        label_name++;
     }
     /* Check if label exceeds maximum allowed length */
-    if (label_length > 31) {
+    if (length > 31) {
         return OUT_OF_RANGE;
     }
+    /* Reserved words can't be used as labels */
+    if (is_reserved_word(label_name, length)) {
+        return INVALID_VALUE;
+    }
     return 0; /* Label is valid */
 }
 
-/* Function to split a string into tokens based on whitespace */
-struct StringTokens split_by_spaces(char *input_string) {
-    int token_count = 0;
-    char *current_pos;
-    struct StringTokens tokens = {0};
-
-    /* Skip leading whitespace */
-    while (isspace(*input_string)) input_string++;
+/* Function to classify a word as one of the reserved words with a single hash probe and compare.
+ * Returns keyword_none for any other word, otherwise stores the keyword's code when code is not NULL */
+keyword_kind classify_keyword(const char *word, int length, int *code) {
+    const struct KeywordInfo *keyword;
+    int slot;
 
-    /* If the string is empty after removing leading whitespace, return */
-    if (*input_string == '\0') {
-        return tokens;
+    if (length < MIN_KEYWORD_LENGTH || length > MAX_KEYWORD_LENGTH) {
+        return keyword_none;
     }
-
-    /* Loop to tokenize the string by spaces */
-    while (1) {
-        tokens.string_tokens[token_count++] = input_string; /* Store the start of the token */
-        current_pos = strpbrk(input_string, WHITESPACE); /* Find the next space character */
-
-        if (current_pos) {
-            *current_pos = '\0'; /* Terminate the current token */
-            current_pos++;
-
-            /* Skip any additional spaces */
-            while (isspace(*current_pos)) current_pos++;
-
-            /* If the end of the string is reached, break the loop */
-            if (*current_pos == '\0') {
-                break;
-            }
-
-            /* Move input_string to the start of the next token */
-            input_string = current_pos;
-        } else {
-            /* No more spaces found, break the loop */
-            break;
-        }
+    slot = keyword_slots[KEYWORD_HASH(word, length)];
+    if (slot < 0) {
+        return keyword_none;
     }
+    keyword = &keyword_table[slot];
+    if (keyword->length != length || memcmp(keyword->keyword_name, word, length) != 0) {
+        return keyword_none;
+    }
+    if (code != NULL) {
+        *code = keyword->code;
+    }
+    return keyword->kind;
+}
 
-    tokens.token_count = token_count; /* Set the number of tokens found */
-    return tokens;
+/* Function to check if a word is reserved and so can't name a label or a macro */
+int is_reserved_word(const char *word, int length) {
+    return classify_keyword(word, length, NULL) != keyword_none;
 }
 
 /* Function to find an instruction by its name */
-struct OpcodeInfo *find_instruction_by_name(char *instruction_name) {
-    int i;
+struct OpcodeInfo *find_instruction_by_name(const char *instruction_name, int length) {
+    int code;
 
-    /* Loop through the opcode_table array to find a matching instruction name */
-    for (i = 0; i < NUMBER_OF_OPCODES; i++) {
-        /* Compare the input instruction name with the current instruction's name */
-        if (strcmp(instruction_name, opcode_table[i].opcode_name) == 0) {
-            /* Return a pointer to the matching instruction */
-            return &opcode_table[i];
-        }
+    if (classify_keyword(instruction_name, length, &code) != keyword_opcode) {
+        return NULL;
     }
-
-    /* If no matching instruction is found, return NULL */
-    return NULL;
+    return &opcode_table[code];
 }
 
 /* Function to find a directive by its name */
-struct DirectiveInfo *find_directive_by_name(char *directive_name) {
-    int i;
-    /* Loop through the directives array to find a matching directive name */
-    for (i = 0; i < NUMBER_OF_DIRECTIVES; i++) {
-        /* Compare the input directive name with the current directive's name */
-        if (strcmp(directives_list[i].directive_name, directive_name) == 0) {
-            /* Return a pointer to the matching directive */
-            return &directives_list[i];
-        }
+struct DirectiveInfo *find_directive_by_name(const char *directive_name, int length) {
+    int code;
+
+    if (classify_keyword(directive_name, length, &code) != keyword_directive) {
+        return NULL;
     }
+    return &directives_list[code];
+}
 
-    /* If no matching directive is found, return NULL */
-    return NULL;
+/* Function to find the encoding template of an instruction by its opcode and operand modes */
+const struct instruction_template *find_instruction_template(int opcode, int source_mode, int destination_mode) {
+    return &instruction_templates[opcode][source_mode][destination_mode];
 }
 
-/* Function to validate a number within a given range */
-int validate_number(char *number_str, int *value, int min_value, int max_value) {
-    char *end_ptr;
-    /* Convert the string to an integer and store the end pointer */
-    *value = strtol(number_str, &end_ptr, 10);
+/* Function to validate a number of the given length within a given range.
+ * It follows strtol: overflowing values saturate before being stored in the int. */
+int validate_number(const char *number_str, int length, int *value, int min_value, int max_value) {
+    unsigned long limit, result = 0;
+    int position = 0, digits_start, digit;
+    bool negative = false, overflow = false;
+
+    /* Skip leading whitespace and read the sign */
+    while (position < length && isspace((unsigned char)number_str[position])) position++;
+    if (position < length && (number_str[position] == '-' || number_str[position] == '+')) {
+        negative = number_str[position] == '-';
+        position++;
+    }
+    limit = negative ? (unsigned long)LONG_MAX + 1 : (unsigned long)LONG_MAX;
+
+    /* Accumulate the digits */
+    digits_start = position;
+    while (position < length && isdigit((unsigned char)number_str[position])) {
+        digit = number_str[position] - '0';
+        if (overflow || result > (limit - digit) / 10) {
+            overflow = true;
+        } else {
+            result = result * 10 + digit;
+        }
+        position++;
+    }
+
     /* Check if the conversion failed because no digits were found */
-    if (end_ptr == number_str) {
+    if (position == digits_start) {
+        *value = 0;
         return INVALID_VALUE;
     }
+    if (overflow) {
+        *value = negative ? LONG_MIN : LONG_MAX;
+    } else {
+        *value = negative ? (long)(0 - result) : (long)result;
+    }
     /* Check if there are extra characters after the number */
-    if (*end_ptr != '\0') {
+    if (position != length) {
         return INVALID_VALUE;
     }
     /* Check if the value is outside the acceptable range */
@@ -355,32 +378,35 @@ int validate_number(char *number_str, int *value, int min_value, int max_value)
 }
 
 /* Function to analyze an operand */
-int analyze_operand(char *operand_text, struct OpcodeInfo *instruction, struct OperandInfo *operand_info, int operand_index) {
+int analyze_operand(struct analized_line *current_line, const char *operand_text, int length, int operand_index) {
     /* Skip leading whitespace */
-    while (isspace(*operand_text)) operand_text++;
+    while (length > 0 && isspace((unsigned char)*operand_text)) {
+        operand_text++;
+        length--;
+    }
 
-    if (check_for_extra_text(operand_text) != 0) {
+    if (check_for_extra_text(current_line, operand_text, &length) != 0) {
         /* Error already set in check_for_extra_text */
         return ERROR;
     }
 
-    if (is_valid_register(operand_text)) {
-        if (analyze_direct_register(operand_text, operand_index) != 0) {
+    if (is_valid_register(operand_text, length)) {
+        if (analyze_direct_register(current_line, operand_text, length, operand_index) != 0) {
             /* Error already set in analyze_direct_register */
             return ERROR;
         }
-    } else if (*operand_text == INDIRECT_REGISTER && is_valid_register(operand_text + 1)) {
-        if (analyze_indirect_register(operand_text, operand_index) != 0) {
+    } else if (length > 0 && *operand_text == INDIRECT_REGISTER && is_valid_register(operand_text + 1, length - 1)) {
+        if (analyze_indirect_register(current_line, operand_text, length, operand_index) != 0) {
             /* Error already set in analyze_indirect_register */
             return ERROR;
         }
-    } else if (*operand_text == IMMEDIATE_VAL) {
-        if (analyze_immediate_value(operand_text, operand_index) != 0) {
+    } else if (length > 0 && *operand_text == IMMEDIATE_VAL) {
+        if (analyze_immediate_value(current_line, operand_text, length, operand_index) != 0) {
             /* Error already set in analyze_immediate_value */
             return ERROR;
         }
     } else {
-        if (analyze_label(operand_text, operand_index) != 0) {
+        if (analyze_label(current_line, operand_text, length, operand_index) != 0) {
             /* Error already set in analyze_label */
             return ERROR;
         }
@@ -391,118 +417,115 @@ int analyze_operand(char *operand_text, struct OpcodeInfo *instruction, struct O
 }
 
 /* function to check if the operand is a valid register */
-int is_valid_register(const char *operand) {
-    if (*operand != REGISTER_START) return 0;
-    if (strlen(operand) != 2) return 0;
-    if (operand[1] < '0' || operand[1] > '7') return 0;
-    return 1;
+int is_valid_register(const char *operand, int length) {
+    return classify_keyword(operand, length, NULL) == keyword_register;
 }
 
-/* Function to check for extra text after an operand */
-int check_for_extra_text(char *operand_text) {
-    char *extra_text_pos = strpbrk(operand_text, WHITESPACE);
-    if (extra_text_pos) {
-        *extra_text_pos = '\0';
-        extra_text_pos++;
-        while (isspace(*extra_text_pos)) extra_text_pos++;
-        if (*extra_text_pos != '\0') {
-            sprintf(current_line.error, "Error: extra text:'%s'", extra_text_pos);
-            return 1;
-        }
+/* Function to check for extra text after an operand, the length is cut at the operand's end */
+int check_for_extra_text(struct analized_line *current_line, const char *operand_text, int *length) {
+    int operand_end = 0, extra_text_pos;
+    while (operand_end < *length && !isspace((unsigned char)operand_text[operand_end])) operand_end++;
+    extra_text_pos = operand_end;
+    while (extra_text_pos < *length && isspace((unsigned char)operand_text[extra_text_pos])) extra_text_pos++;
+    if (extra_text_pos < *length) {
+        sprintf(current_line->error, "Error: extra text:'%.*s'", *length - extra_text_pos, operand_text + extra_text_pos);
+        return 1;
     }
+    *length = operand_end;
     return 0;
 }
 
 /* Function to analyze a direct register operand */
-int analyze_direct_register(char *operand_text, int operand_index) {
+int analyze_direct_register(struct analized_line *current_line, const char *operand_text, int length, int operand_index) {
     int reg_number;
-    int validation_result = validate_number(operand_text + 1, &reg_number, 0, 7);
+    int validation_result = validate_number(operand_text + 1, length - 1, &reg_number, 0, 7);
     if (validation_result == 0) {
-        current_line.operand_type[operand_index] = direct_register;
-        current_line.operand_list[operand_index].register_num = reg_number;
+        current_line->operand_type[operand_index] = direct_register;
+        current_line->operand_list[operand_index].register_num = reg_number;
         return 0;
     } else if (validation_result == INVALID_VALUE) {
-        sprintf(current_line.error, "Error: invalid register format: '%s'", operand_text + 1);
+        sprintf(current_line->error, "Error: invalid register format: '%.*s'", length - 1, operand_text + 1);
     } else if (validation_result == OUT_OF_RANGE) {
-        sprintf(current_line.error, "Error: register number out of range (0 to 7): '%s'", operand_text + 1);
+        sprintf(current_line->error, "Error: register number out of range (0 to 7): '%.*s'", length - 1, operand_text + 1);
     } else {
-        sprintf(current_line.error, "Error: unexpected error while validating register: '%s'", operand_text + 1);
+        sprintf(current_line->error, "Error: unexpected error while validating register: '%.*s'", length - 1, operand_text + 1);
     }
     return 1;
 }
 
 /* Function to analyze an indirect register operand */
-int analyze_indirect_register(char *operand_text, int operand_index) {
+int analyze_indirect_register(struct analized_line *current_line, const char *operand_text, int length, int operand_index) {
     int reg_number;
-    int validation_result = validate_number(operand_text + 2, &reg_number, 0, 7);
+    int validation_result = validate_number(operand_text + 2, length - 2, &reg_number, 0, 7);
     if (validation_result == 0) {
-        current_line.operand_type[operand_index] = indirect_register;
-        current_line.operand_list[operand_index].register_num = reg_number;
+        current_line->operand_type[operand_index] = indirect_register;
+        current_line->operand_list[operand_index].register_num = reg_number;
         return 0;
     } else if (validation_result == INVALID_VALUE) {
-        sprintf(current_line.error, "Error: invalid indirect register format: '%s'", operand_text + 2);
+        sprintf(current_line->error, "Error: invalid indirect register format: '%.*s'", length - 2, operand_text + 2);
     } else if (validation_result == OUT_OF_RANGE) {
-        sprintf(current_line.error, "Error: indirect register number out of range (0 to 7): '%s'", operand_text + 2);
+        sprintf(current_line->error, "Error: indirect register number out of range (0 to 7): '%.*s'", length - 2, operand_text + 2);
     } else {
-        sprintf(current_line.error, "Unexpected error while processing: '%s'", operand_text + 2);
+        sprintf(current_line->error, "Unexpected error while processing: '%.*s'", length - 2, operand_text + 2);
     }
     return 1;
 }
 
 /* Function to analyze an immediate value operand */
-int analyze_immediate_value(char *operand_text, int operand_index) {
+int analyze_immediate_value(struct analized_line *current_line, const char *operand_text, int length, int operand_index) {
     int immed_value;
-    int validation_result = validate_number(operand_text + 1, &immed_value, MIN_NUM_RANGE, MAX_NUM_RANGE);
+    int validation_result = validate_number(operand_text + 1, length - 1, &immed_value, MIN_NUM_RANGE, MAX_NUM_RANGE);
     if (validation_result == 0) {
-        current_line.operand_type[operand_index] = immediate;
-        current_line.operand_list[operand_index].immediate_value = immed_value;
+        current_line->operand_type[operand_index] = immediate;
+        current_line->operand_list[operand_index].immediate_value = immed_value;
         return 0;
     } else if (validation_result == INVALID_VALUE) {
-        sprintf(current_line.error, "Error: invalid immediate value format: '%s'", operand_text + 1);
+        sprintf(current_line->error, "Error: invalid immediate value format: '%.*s'", length - 1, operand_text + 1);
     } else if (validation_result == OUT_OF_RANGE) {
-        sprintf(current_line.error, "Error: immediate value out of range (-2048 to 2047): '%s'", operand_text + 1);
+        sprintf(current_line->error, "Error: immediate value out of range (-2048 to 2047): '%.*s'", length - 1, operand_text + 1);
     } else {
-        sprintf(current_line.error, "Unexpected error while validating: '%s'", operand_text + 1);
+        sprintf(current_line->error, "Unexpected error while validating: '%.*s'", length - 1, operand_text + 1);
     }
     return 1;
 }
 
 /* Function to analyze a label operand */
-int analyze_label(char *operand_text, int operand_index) {
-    int label_check = validate_label(operand_text, 0);
+int analyze_label(struct analized_line *current_line, const char *operand_text, int length, int operand_index) {
+    int label_check = validate_label(operand_text, length, 0);
     if (label_check == 0) {
-        current_line.operand_type[operand_index] = label;
-        current_line.operand_list[operand_index].label_name = operand_text;
+        current_line->operand_type[operand_index] = label;
+        current_line->operand_list[operand_index].label_name.text = operand_text;
+        current_line->operand_list[operand_index].label_name.length = length;
         return 0;
     } else if (label_check == INVALID_VALUE) {
-        sprintf(current_line.error, "Error: invalid operand:'%s'", operand_text);
+        sprintf(current_line->error, "Error: invalid operand:'%.*s'", length, operand_text);
     } else if (label_check == OUT_OF_RANGE) {
-        sprintf(current_line.error, "Error: invalid label (too long):'%s'", operand_text);
+        sprintf(current_line->error, "Error: invalid label (too long):'%.*s'", length, operand_text);
     }
     return 1;
 }
 
 /* Function to pre-analyze operands */
-int pre_analyze_operand(char *operands_text, struct OpcodeInfo *instruction, struct OperandInfo *operand_info) {
-    char *first_operand, *second_operand;
+int pre_analyze_operand(struct analized_line *current_line, const char *operands_text, int length, struct OperandInfo *operand_info) {
+    text_span first_operand, second_operand;
     int operand_count;
 
-    operand_count = split_operands(operands_text, &first_operand, &second_operand);
+    operand_count = split_operands(operands_text, length, &first_operand, &second_operand);
 
-    if (!validate_operand_count(operand_count, operand_info)) {
+    if (!validate_operand_count(current_line, operand_count, operand_info)) {
         /* Error: Invalid operand count */
         return ERROR;
     }
 
     if (operand_count >= 1) {
-        if (analyze_operand(first_operand, instruction, operand_info, operand_count == 1 ? 1 : 0) != 0) {
+        if (analyze_operand(current_line, first_operand.text, first_operand.length, operand_count == 1 ? 1 : 0) != 0) {
             /* Error occurred in first operand */
             return ERROR;
         }
     }
 
     if (operand_count == 2) {
-        if (analyze_operand(second_operand, instruction, operand_info, 1) != 0) {
+        if (analyze_operand(current_line, second_operand.text, second_operand.length, 1) != 0) {
             /* Error occurred in second operand */
             return ERROR;
         }
@@ -511,156 +534,358 @@ int pre_analyze_operand(char *operands_text, struct OpcodeInfo *instruction, str
     /* Success: All operands analyzed without errors */
     return 0;
 }
-/* Function to split operands into separate strings */
-int split_operands(char *operands_text, char **first_operand, char **second_operand) {
-    char *comma_pos = strchr(operands_text, ',');
 
+/* Function to split operands into separate spans at the first comma */
+int split_operands(const char *operands_text, int length, text_span *first_operand, text_span *second_operand) {
+    const char *comma_pos = memchr(operands_text, ',', length);
+
+    first_operand->text = operands_text;
     if (comma_pos) {
-        *comma_pos = '\0';
-        *first_operand = operands_text;
-        *second_operand = comma_pos + 1;
+        first_operand->length = comma_pos - operands_text;
+        second_operand->text = comma_pos + 1;
+        second_operand->length = length - first_operand->length - 1;
 
         /* Trim leading whitespace from second operand */
-        while (isspace(**second_operand)) (*second_operand)++;
+        while (second_operand->length > 0 && isspace((unsigned char)*second_operand->text)) {
+            second_operand->text++;
+            second_operand->length--;
+        }
 
         return 2; /* Two operands found */
     } else {
-        *first_operand = operands_text;
-        *second_operand = NULL;
+        first_operand->length = length;
+        second_operand->text = NULL;
+        second_operand->length = 0;
         return 1; /* One operand found */
     }
 }
 
 /* Function to validate the number of operands */
-int validate_operand_count(int operand_count, struct OperandInfo *operand_info) {
+int validate_operand_count(struct analized_line *current_line, int operand_count, struct OperandInfo *operand_info) {
     if (operand_count == 2 && operand_info->source_operand == NULL) {
-        sprintf(current_line.error, "Error: second operand found");
+        sprintf(current_line->error, "Error: second operand found");
         return 0;
     }
     if (operand_count == 1 && operand_info->source_operand != NULL) {
-        sprintf(current_line.error, "Error: second operand not found");
+        sprintf(current_line->error, "Error: second operand not found");
         return 0;
     }
     return 1;
 }
 
 /* Function to process a directive */
-int process_directive(char *directive_text, struct DirectiveInfo *directive_info) {
-    current_line.directive_type = directive_info->directive_code;
+int process_directive(struct analized_line *current_line, const char *directive_text, int length, struct DirectiveInfo *directive_info) {
+    current_line->directive_type = directive_info->directive_code;
 
     if (directive_info->directive_code == directive_entry || directive_info->directive_code == directive_extern) {
-        if (!process_entry_extern(directive_text)) {
+        if (!process_entry_extern(current_line, directive_text, length)) {
             return ERROR; /* Error in processing entry or extern directive */
         }
     } else if (directive_info->directive_code == directive_string) {
-        if (!process_string(directive_text)) {
+        if (!process_string(current_line, directive_text, length)) {
             return ERROR; /* Error in processing string directive */
         }
     } else if (directive_info->directive_code == directive_data) {
-        if (!process_data(directive_text)) {
+        if (!process_data(current_line, directive_text, length)) {
             return ERROR; /* Error in processing data directive */
         }
     } else {
-        sprintf(current_line.error, "Error: unknown directive type");
+        sprintf(current_line->error, "Error: unknown directive type");
         return ERROR; /* Unknown directive type */
     }
 
     return 0; /* Success */
 }
 
+/* Function to process the 'label = number' part of a .define statement */
+int process_define(struct analized_line *current_line, const char *define_text, int length) {
+    const char *equal_pos;
+    int label_length = 0, value_start, value_end, extra_text_pos;
+    int validation_result;
+
+    equal_pos = memchr(define_text, '=', length);
+    if (equal_pos == NULL) {
+        /* Report error if '=' is missing */
+        sprintf(current_line->error, "Error: '=' was not found.");
+        return ERROR;
+    }
+
+    /* The label ends at the first space or at the '=' */
+    while (define_text + label_length < equal_pos && !isspace((unsigned char)define_text[label_length])) label_length++;
+
+    /* The number starts after the '=' and ends at the first space */
+    value_start = equal_pos - define_text + 1;
+    while (value_start < length && isspace((unsigned char)define_text[value_start])) value_start++;
+    value_end = value_start;
+    while (value_end < length && !isspace((unsigned char)define_text[value_end])) value_end++;
+    extra_text_pos = value_end;
+    while (extra_text_pos < length && isspace((unsigned char)define_text[extra_text_pos])) extra_text_pos++;
+
+    if (extra_text_pos < length) {
+        /* If extra text is found, report an error */
+        sprintf(current_line->error, "Error: extra text:'%.*s'", length - extra_text_pos, define_text + extra_text_pos);
+        return ERROR;
+    }
+
+    /* Validate label and number for .define */
+    if (validate_label(define_text, label_length, 0) != 0) {
+        sprintf(current_line->error, "Error: invalid label or no label found:'%.*s'", label_length, define_text);
+        return ERROR;
+    }
+
+    validation_result = validate_number(define_text + value_start, value_end - value_start, &current_line->definition_count, MIN_NUM_RANGE, MAX_NUM_RANGE);
+    current_line->line_type = definition_line;
+    current_line->definition_label.text = define_text;
+    current_line->definition_label.length = label_length;
+
+    if (validation_result == INVALID_VALUE) {
+        sprintf(current_line->error, "Error: invalid number format: '%.*s'", value_end - value_start, define_text + value_start);
+        return ERROR;
+    } else if (validation_result == OUT_OF_RANGE) {
+        sprintf(current_line->error, "Error: number out of range (-2048 to 2047): '%.*s'", value_end - value_start, define_text + value_start);
+        return ERROR;
+    }
+    return 0;
+}
+
 /* Function to process .entry or .extern directives */
-int process_entry_extern(char *directive_text) {
-    char *delimiter_pos;
-
-    delimiter_pos = strpbrk(directive_text, WHITESPACE);
-    if (delimiter_pos) {
-        *delimiter_pos = '\0';
-        delimiter_pos++;
-        while (isspace(*delimiter_pos)) delimiter_pos++;
-        if (*delimiter_pos != '\0') {
-            sprintf(current_line.error, "Error: extra text:'%s'", delimiter_pos);
-            return 0;
-        }
+int process_entry_extern(struct analized_line *current_line, const char *directive_text, int length) {
+    int label_length = 0, delimiter_pos;
+
+    while (label_length < length && !isspace((unsigned char)directive_text[label_length])) label_length++;
+    delimiter_pos = label_length;
+    while (delimiter_pos < length && isspace((unsigned char)directive_text[delimiter_pos])) delimiter_pos++;
+    if (delimiter_pos < length) {
+        sprintf(current_line->error, "Error: extra text:'%.*s'", length - delimiter_pos, directive_text + delimiter_pos);
+        return 0;
     }
-    if (validate_label(directive_text, 0) == 0) {
-        current_line.directive_label = directive_text;
+    if (validate_label(directive_text, label_length, 0) == 0) {
+        current_line->directive_label.text = directive_text;
+        current_line->directive_label.length = label_length;
         return 1;
     } else {
-        sprintf(current_line.error, "Error: invalid label: '%s'", directive_text);
+        sprintf(current_line->error, "Error: invalid label: '%.*s'", label_length, directive_text);
         return 0;
     }
 }
 
-/* Function to process a .string directive */
-int process_string(char *directive_text) {
-    char *quote_pos;
+/* Function to process a .string directive, the string spans up to the last quote of the line */
+int process_string(struct analized_line *current_line, const char *directive_text, int length) {
+    int quote_pos;
 
     if (*directive_text != '"') {
-        sprintf(current_line.error, "Error: string didn't start correctly");
+        sprintf(current_line->error, "Error: string didn't start correctly");
         return 0;
     }
 
-    quote_pos = strrchr(directive_text + 1, '"');
-    if (directive_text == quote_pos) {
-        sprintf(current_line.error, "Error: string didn't terminate correctly");
+    quote_pos = length - 1;
+    while (quote_pos > 0 && directive_text[quote_pos] != '"') quote_pos--;
+    if (quote_pos == 0) {
+        sprintf(current_line->error, "Error: string didn't terminate correctly");
         return 0;
     }
 
-    *quote_pos = '\0';
+    current_line->directive_string.text = directive_text + 1;
+    current_line->directive_string.length = quote_pos - 1;
+
     quote_pos++;
-    while (isspace(*quote_pos)) quote_pos++;
-    if (*quote_pos != '\0') {
-        sprintf(current_line.error, "Error: extra text");
+    while (quote_pos < length && isspace((unsigned char)directive_text[quote_pos])) quote_pos++;
+    if (quote_pos < length) {
+        sprintf(current_line->error, "Error: extra text");
         return 0;
     }
 
-    current_line.directive_string = directive_text + 1;
     return 1;
 }
 
-/* Function to process a .data directive */
-int process_data(char *directive_text) {
-    char *token, *saveptr;
-    char *end;
+/* Function to process a .data directive, empty entries between commas are skipped */
+int process_data(struct analized_line *current_line, const char *directive_text, int length) {
+    int position = 0, token_start, token_end;
     int validation_result;
-    int is_first_token = 1;
+    int value;
 
-    token = strtok_r(directive_text, D_COMMA, &saveptr);
-    while (token != NULL) {
-        /* Check for consecutive commas */
-        if (!is_first_token && token[0] == '\0') {
-            sprintf(current_line.error, "Error: two commas in a row");
-            return 0;
+    while (1) {
+        /* Skip the commas before the next value */
+        while (position < length && directive_text[position] == COMMA) position++;
+        if (position >= length) {
+            break;
         }
-        is_first_token = 0;
+        token_start = position;
+        while (position < length && directive_text[position] != COMMA) position++;
+        token_end = position;
 
         /* Trim leading and trailing whitespace */
-        while (isspace(*token)) token++;
-        end = token + strlen(token) - 1;
-        while (end > token && isspace(*end)) end--;
-        *(end + 1) = '\0';
+        while (token_start < token_end && isspace((unsigned char)directive_text[token_start])) token_start++;
+        while (token_end > token_start && isspace((unsigned char)directive_text[token_end - 1])) token_end--;
 
-        if (*token == '\0') {
-            sprintf(current_line.error, "Error: empty data value");
+        if (token_start == token_end) {
+            sprintf(current_line->error, "Error: empty data value");
             return 0;
         }
 
-        validation_result = validate_number(token, &current_line.data_value[current_line.data_size], MIN_DATA_RANGE, MAX_DATA_RANGE);
+        validation_result = validate_number(directive_text + token_start, token_end - token_start,
+                                            &value, MIN_DATA_RANGE, MAX_DATA_RANGE);
         if (validation_result == 0) {
-            current_line.data_size++;
+            current_line->data_value[current_line->data_size++] = TO_WORD(value);
         } else if (validation_result == INVALID_VALUE) {
-            sprintf(current_line.error, "Error: invalid data format: '%s'", token);
+            sprintf(current_line->error, "Error: invalid data format: '%.*s'", token_end - token_start, directive_text + token_start);
             return 0;
         } else if (validation_result == OUT_OF_RANGE) {
-            sprintf(current_line.error, "Error: data value out of range (-8192 to 8191): '%s'", token);
+            sprintf(current_line->error, "Error: data value out of range (-8192 to 8191): '%.*s'", token_end - token_start, directive_text + token_start);
             return 0;
         } else {
-            sprintf(current_line.error, "Error: unexpected error while validating data: '%s'", token);
+            sprintf(current_line->error, "Error: unexpected error while validating data: '%.*s'", token_end - token_start, directive_text + token_start);
             return 0;
         }
-
-        token = strtok_r(NULL, D_COMMA, &saveptr);
     }
 
     return 1;
-}
\ No newline at end of file
+}
+
+/* Function to rebuild the index of a line memo with a new capacity, a power of two */
+static void rebuild_memo_index(struct line_memo *memo, int capacity) {
+    unsigned long slot;
+    int i;
+
+    free(memo->index);
+    memo->index = malloc(capacity * sizeof(*memo->index));
+    if (memo->index == NULL) {
+        fprintf(stderr, "[ERROR] Out of memory, aborting.\n");
+        exit(1);
+    }
+    memo->index_capacity = capacity;
+    for (i = 0; i < capacity; i++) {
+        memo->index[i] = NOT_FOUND;
+    }
+
+    /* Reinsert every line using its stored hash */
+    for (i = 0; i < memo->lines_count; i++) {
+        slot = memo->keys[i].hash & (capacity - 1);
+        while (memo->index[slot] != NOT_FOUND) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        memo->index[slot] = i;
+    }
+}
+
+/* Function to keep the analysis in the scratch of a memo as its next compact analysis */
+static void store_memo_analysis(struct line_memo *memo) {
+    const struct analized_line *line = &memo->scratch;
+    memo_analysis *analysis;
+    int length;
+
+    memo->analyses = grow_array(memo->analyses, &memo->analyses_capacity, memo->lines_count + 1, sizeof(*memo->analyses));
+    analysis = &memo->analyses[memo->lines_count];
+    analysis->label_name = line->label_name;
+    analysis->line_type = line->line_type;
+    analysis->opcode = line->opcode;
+    analysis->operand_type[0] = line->operand_type[0];
+    analysis->operand_type[1] = line->operand_type[1];
+    analysis->operand_list[0] = line->operand_list[0];
+    analysis->operand_list[1] = line->operand_list[1];
+    analysis->definition_label = line->definition_label;
+    analysis->definition_count = line->definition_count;
+    analysis->directive_type = line->directive_type;
+    analysis->directive_label = line->directive_label;
+    analysis->directive_string = line->directive_string;
+    analysis->data_size = line->data_size;
+    analysis->error_offset = NOT_FOUND;
+    analysis->data_offset = 0;
+
+    /* The error text is kept with its null character */
+    if (line->error[0] != '\0') {
+        length = strlen(line->error) + 1;
+        memo->errors = grow_array(memo->errors, &memo->errors_capacity, memo->errors_size + length, sizeof(*memo->errors));
+        memcpy(memo->errors + memo->errors_size, line->error, length);
+        analysis->error_offset = memo->errors_size;
+        memo->errors_size += length;
+    } else if (line->line_type == directive_line && line->directive_type == directive_data) {
+        memo->data_values = grow_array(memo->data_values, &memo->data_values_capacity,
+                                       memo->data_values_size + line->data_size, sizeof(*memo->data_values));
+        memcpy(memo->data_values + memo->data_values_size, line->data_value, line->data_size * sizeof(*memo->data_values));
+        analysis->data_offset = memo->data_values_size;
+        memo->data_values_size += line->data_size;
+    }
+}
+
+/* Function to analyze a line through a memo, a line seen before reuses the analysis of its first occurrence.
+ * Returns the index of the compact analysis of the line in the memo */
+int analyze_line_memoized(struct line_memo *memo, const char *assembly_line, int line_length) {
+    unsigned long hash = hash_bytes(HASH_SEED, assembly_line, line_length);
+    unsigned long slot;
+    memo_key *key;
+
+    /* Probe the index until an empty slot, comparing texts only when the hashes match */
+    if (memo->index_capacity > 0) {
+        slot = hash & (memo->index_capacity - 1);
+        while (memo->index[slot] != NOT_FOUND) {
+            key = &memo->keys[memo->index[slot]];
+            if (key->hash == hash && key->length == line_length && memcmp(key->text, assembly_line, line_length) == 0) {
+                memo->hits++;
+                return memo->index[slot];
+            }
+            slot = (slot + 1) & (memo->index_capacity - 1);
+        }
+    }
+
+    /* A new line is analyzed in the scratch and kept at the end of the memo */
+    analyze_line(assembly_line, line_length, &memo->scratch);
+    store_memo_analysis(memo);
+    memo->keys = grow_array(memo->keys, &memo->keys_capacity, memo->lines_count + 1, sizeof(*memo->keys));
+    key = &memo->keys[memo->lines_count];
+    key->text = assembly_line;
+    key->length = line_length;
+    key->hash = hash;
+    memo->lines_count++;
+    memo->misses++;
+
+    /* Keep the index at most half full, the rebuild also inserts the new line */
+    if (memo->lines_count * 2 > memo->index_capacity) {
+        rebuild_memo_index(memo, memo->index_capacity > 0 ? memo->index_capacity * 2 : MIN_INDEX_CAPACITY);
+    } else {
+        slot = hash & (memo->index_capacity - 1);
+        while (memo->index[slot] != NOT_FOUND) {
+            slot = (slot + 1) & (memo->index_capacity - 1);
+        }
+        memo->index[slot] = memo->lines_count - 1;
+    }
+    return memo->lines_count - 1;
+}
+
+/* Function to rebuild a full analyzed line from a compact analysis of a memo, returns line */
+const struct analized_line *expand_memo_analysis(const struct line_memo *memo, int analysis, struct analized_line *line) {
+    const memo_analysis *compact = &memo->analyses[analysis];
+
+    line->label_name = compact->label_name;
+    line->line_type = compact->line_type;
+    line->opcode = compact->opcode;
+    line->operand_type[0] = compact->operand_type[0];
+    line->operand_type[1] = compact->operand_type[1];
+    line->operand_list[0] = compact->operand_list[0];
+    line->operand_list[1] = compact->operand_list[1];
+    line->definition_label = compact->definition_label;
+    line->definition_count = compact->definition_count;
+    line->directive_type = compact->directive_type;
+    line->directive_label = compact->directive_label;
+    line->directive_string = compact->directive_string;
+    line->data_size = compact->data_size;
+    if (compact->error_offset != NOT_FOUND) {
+        strcpy(line->error, memo->errors + compact->error_offset);
+    } else {
+        line->error[0] = '\0';
+        if (compact->line_type == directive_line && compact->directive_type == directive_data) {
+            memcpy(line->data_value, memo->data_values + compact->data_offset, compact->data_size * sizeof(*line->data_value));
+        }
+    }
+    return line;
+}
+
+/* Function to release the memory of a line memo */
+void free_line_memo(struct line_memo *memo) {
+    free(memo->analyses);
+    free(memo->keys);
+    free(memo->index);
+    free(memo->errors);
+    free(memo->data_values);
+    memset(memo, 0, sizeof(*memo));
+}
@@ -17,11 +17,17 @@ typedef enum opcode {
     opcode_dec, opcode_jmp, opcode_bne, opcode_red, opcode_prn, opcode_jsr, opcode_rts, opcode_stop
 } opcode;
 
+/* Structure to represent a span of text inside the analyzed line, it is not null terminated */
+typedef struct text_span {
+    const char *text;
+    int length;
+} text_span;
+
 /* Structure to represent an operand */
 typedef struct operand {
     int register_num;
     int immediate_value;
-    char *label_name;
+    text_span label_name;
 } operand;
 
 /* Enumeration for line types */
@@ -48,49 +54,147 @@ typedef enum operand_type {
     direct_register = DIRECT
 } operand_type;
 
-/* Structure to represent an analyzed line of assembly code */
+/* Enumeration for the kinds of extra words that follow the first word of an instruction */
+typedef enum extra_word_kind {
+    extra_none,
+    extra_immediate,
+    extra_label,
+    extra_register,
+    extra_register_pair
+} extra_word_kind;
+
+/* Structure to represent the encoding of an opcode with given source and destination modes:
+ * its first word, its total word count, and the kind of each extra word with the operand it encodes */
+typedef struct instruction_template {
+    int first_word;
+    int word_count;
+    unsigned char extra_kind[2];
+    unsigned char extra_operand[2];
+} instruction_template;
+
+/* Structure to represent an analyzed line of assembly code.
+ * The names and the string in it are spans of the analyzed line, which must outlive the result. */
 typedef struct analized_line {
     char error[MAX_ERROR_LENGTH];
-    char *label_name;
+    text_span label_name;
     line_type line_type;  
     opcode opcode;
     operand_type operand_type[2];
     operand operand_list[2];
-    char *definition_label;
+    text_span definition_label;
     int definition_count;
     directive_type directive_type;  
-    char *directive_label;
-    char *directive_string;
-    int data_value[MAX_DATA_VALUE_LENGTH];
+    text_span directive_label;
+    text_span directive_string;
+    uint16_t data_value[MAX_DATA_VALUE_LENGTH];
     int data_size;
 } analized_line;
 
+/* Structure to represent the text of a memoized line with its hash */
+typedef struct memo_key {
+    const char *text;
+    int length;
+    unsigned long hash;
+} memo_key;
+
+/* Structure to represent a memoized analysis without the fixed size buffers of an analyzed line.
+ * Its error text and data values are kept in the arenas of the memo, error_offset is NOT_FOUND for a line without error */
+typedef struct memo_analysis {
+    text_span label_name;
+    line_type line_type;
+    opcode opcode;
+    operand_type operand_type[2];
+    operand operand_list[2];
+    text_span definition_label;
+    int definition_count;
+    directive_type directive_type;
+    text_span directive_label;
+    text_span directive_string;
+    int data_size;
+    int error_offset;
+    int data_offset;
+} memo_analysis;
+
+/* Structure to hold the analyses of the distinct lines of a source, keyed by the exact text of each line.
+ * Analysis depends on the text of the line only, so a repeated line, such as a line of an expanded macro,
+ * reuses the analysis of its first occurrence. The spans of an analysis point into that first occurrence.
+ * Every line is analyzed into scratch and kept in compact form, only error lines and .data lines use the arenas */
+typedef struct line_memo {
+    memo_analysis *analyses;
+    int analyses_capacity;
+    memo_key *keys;
+    int keys_capacity;
+    int lines_count;
+    int *index;
+    int index_capacity;
+    char *errors;
+    int errors_size;
+    int errors_capacity;
+    uint16_t *data_values;
+    int data_values_size;
+    int data_values_capacity;
+    struct analized_line scratch;
+    long hits;
+    long misses;
+} line_memo;
+
+/* Enumeration for the kinds of tokens produced by the line lexer */
+typedef enum token_kind {
+    token_word,
+    token_directive,
+    token_label
+} token_kind;
+
+/* Structure to represent a whitespace separated token as an offset and a length in the line */
+typedef struct line_token {
+    int offset;
+    int length;
+    token_kind kind;
+} line_token;
+
+/* Enumeration for the kinds of reserved words of the language */
+typedef enum keyword_kind {
+    keyword_none,
+    keyword_opcode,
+    keyword_directive,
+    keyword_define,
+    keyword_register,
+    keyword_macro
+} keyword_kind;
+
 /* declarations of structures */
-typedef struct StringTokens StringTokens; 
 typedef struct OpcodeInfo OpcodeInfo;  
 typedef struct OperandInfo OperandInfo;  
 typedef struct DirectiveInfo DirectiveInfo; 
 
 /* Function Prototypes */
-int analyze_assembly_line(char *assembly_line);
-int validate_label(char *label_name, int brackets);
-struct StringTokens split_by_spaces(char *input_string);
-struct OpcodeInfo *find_instruction_by_name(char *instruction_name);
-struct DirectiveInfo *find_directive_by_name(char *directive_name);
-int validate_number(char *number_str, int *value, int min_value, int max_value);
-int analyze_operand(char *operand_text, struct OpcodeInfo *instruction, struct OperandInfo *operand_info, int operand_index);
-int is_valid_register(const char *operand);
-int check_for_extra_text(char *operand_text);
-int analyze_direct_register(char *operand_text, int operand_index);
-int analyze_indirect_register(char *operand_text, int operand_index);
-int analyze_immediate_value(char *operand_text, int operand_index);
-int analyze_label(char *operand_text, int operand_index);
-int pre_analyze_operand(char *operands_text, struct OpcodeInfo *instruction, struct OperandInfo *operand_info);
-int split_operands(char *operands_text, char **first_operand, char **second_operand);
-int validate_operand_count(int operand_count, struct OperandInfo *operand_info);
-int process_directive(char *directive_text, struct DirectiveInfo *directive_info);
-int process_entry_extern(char *directive_text);
-int process_string(char *directive_text);
-int process_data(char *directive_text);
+int analyze_assembly_line(struct analized_line *current_line, const char *assembly_line);
+int analyze_line(const char *assembly_line, int line_length, struct analized_line *current_line);
+int analyze_line_memoized(struct line_memo *memo, const char *assembly_line, int line_length);
+const struct analized_line *expand_memo_analysis(const struct line_memo *memo, int analysis, struct analized_line *line);
+void free_line_memo(struct line_memo *memo);
+int next_token(const char *line, int line_length, int position, struct line_token *token);
+keyword_kind classify_keyword(const char *word, int length, int *code);
+int is_reserved_word(const char *word, int length);
+int validate_label(const char *label_name, int length, int brackets);
+struct OpcodeInfo *find_instruction_by_name(const char *instruction_name, int length);
+struct DirectiveInfo *find_directive_by_name(const char *directive_name, int length);
+const struct instruction_template *find_instruction_template(int opcode, int source_mode, int destination_mode);
+int validate_number(const char *number_str, int length, int *value, int min_value, int max_value);
+int analyze_operand(struct analized_line *current_line, const char *operand_text, int length, int operand_index);
+int is_valid_register(const char *operand, int length);
+int check_for_extra_text(struct analized_line *current_line, const char *operand_text, int *length);
+int analyze_direct_register(struct analized_line *current_line, const char *operand_text, int length, int operand_index);
+int analyze_indirect_register(struct analized_line *current_line, const char *operand_text, int length, int operand_index);
+int analyze_immediate_value(struct analized_line *current_line, const char *operand_text, int length, int operand_index);
+int analyze_label(struct analized_line *current_line, const char *operand_text, int length, int operand_index);
+int pre_analyze_operand(struct analized_line *current_line, const char *operands_text, int length, struct OperandInfo *operand_info);
+int split_operands(const char *operands_text, int length, text_span *first_operand, text_span *second_operand);
+int validate_operand_count(struct analized_line *current_line, int operand_count, struct OperandInfo *operand_info);
+int process_directive(struct analized_line *current_line, const char *directive_text, int length, struct DirectiveInfo *directive_info);
+int process_define(struct analized_line *current_line, const char *define_text, int length);
+int process_entry_extern(struct analized_line *current_line, const char *directive_text, int length);
+int process_string(struct analized_line *current_line, const char *directive_text, int length);
+int process_data(struct analized_line *current_line, const char *directive_text, int length);
 
 #endif 
\ No newline at end of file
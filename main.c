@@ -3,12 +3,125 @@
  */
 
 #include "main.h"
+#include "worker_pool.h"
+#include "build_cache.h"
+#include "stats.h"
 
-/* Main function to iterate over command-line arguments and process each file */
+/* Main function to iterate over command-line arguments and process each file.
+ * Exits with 1 when any file failed to assemble */
 int main(int argc, char **argv) {
+    struct assembler_options options;
+    char **filenames;
+    FILE *stats_file;
+    int files_count;
+    int result = 0;
     int i;
+
+    filenames = malloc(argc * sizeof(*filenames));
+    if (filenames == NULL) {
+        fprintf(stderr, "[ERROR] Out of memory, aborting.\n");
+        return 1;
+    }
+
+    if (parse_arguments(argc, argv, &options, filenames, &files_count) != 0) {
+        free(filenames);
+        return 1;
+    }
+
+    /* Assemble the files and the chunks of large files on a pool of workers when more than one job is requested */
+    if (options.jobs > 1) {
+        result = run_worker_pool(filenames, files_count, &options);
+    } else {
+        for (i = 0; i < files_count; i++) {
+            if (process_file(filenames[i], &options) != 0) {
+                result = ERROR;
+            }
+        }
+    }
+
+    /* Report how many files the cache saved from being assembled */
+    if (options.cache_dir != NULL) {
+        print_cache_statistics();
+    }
+
+    /* Report the time and the work of every file and of the whole run.
+     * JSON goes to its own file or to stderr, so it never mixes with the diagnostics on stdout */
+    if (options.stats == stats_text) {
+        print_stats(stdout, filenames, files_count, options.stats, options.hardware_counters);
+    } else if (options.stats == stats_json && options.stats_path == NULL) {
+        print_stats(stderr, filenames, files_count, options.stats, options.hardware_counters);
+    } else if (options.stats == stats_json) {
+        stats_file = fopen(options.stats_path, MODE_WRITE);
+        if (stats_file == NULL) {
+            fprintf(stderr, "Error: Unable to create statistics file: %s\n", options.stats_path);
+            result = ERROR;
+        } else {
+            print_stats(stats_file, filenames, files_count, options.stats, options.hardware_counters);
+            fclose(stats_file);
+        }
+    }
+
+    free(filenames);
+    return result != 0 ? 1 : 0;
+}
+
+/* Function to read the option flags, every other argument is a file to assemble */
+int parse_arguments(int argc, char **argv, struct assembler_options *options, char **filenames, int *files_count) {
+    char *end_ptr;
+    int i;
+
+    options->write_am = true;
+    options->binary_object = false;
+    options->cache_dir = NULL;
+    options->jobs = 1;
+    options->stats = stats_off;
+    options->stats_path = NULL;
+    options->hardware_counters = false;
+    *files_count = 0;
+
     for (i = 1; i < argc; i++) {
-        process_file(argv[i]);
+        if (strcmp(argv[i], NO_AM_FLAG) == 0) {
+            options->write_am = false;
+        } else if (strcmp(argv[i], BINARY_FLAG) == 0) {
+            options->binary_object = true;
+        } else if (strcmp(argv[i], STATS_FLAG) == 0) {
+            options->stats = stats_text;
+        } else if (strcmp(argv[i], STATS_JSON_FLAG) == 0) {
+            options->stats = stats_json;
+        } else if (strncmp(argv[i], STATS_JSON_PATH_FLAG, strlen(STATS_JSON_PATH_FLAG)) == 0) {
+            options->stats = stats_json;
+            options->stats_path = argv[i] + strlen(STATS_JSON_PATH_FLAG);
+            if (*options->stats_path == '\0') {
+                fprintf(stderr, "Error: %s requires a file\n", STATS_JSON_PATH_FLAG);
+                return ERROR;
+            }
+        } else if (strcmp(argv[i], PERF_COUNTERS_FLAG) == 0) {
+            options->hardware_counters = true;
+        } else if (strcmp(argv[i], CACHE_DIR_FLAG) == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires a directory\n", CACHE_DIR_FLAG);
+                return ERROR;
+            }
+            options->cache_dir = argv[++i];
+        } else if (strcmp(argv[i], JOBS_FLAG) == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "Error: %s requires a number of jobs\n", JOBS_FLAG);
+                return ERROR;
+            }
+            i++;
+            options->jobs = strtol(argv[i], &end_ptr, 10);
+            if (end_ptr == argv[i] || *end_ptr != '\0' || options->jobs < 1) {
+                fprintf(stderr, "Error: invalid number of jobs: '%s'\n", argv[i]);
+                return ERROR;
+            }
+        } else {
+            filenames[(*files_count)++] = argv[i];
+        }
+    }
+
+    /* Hardware counters are reported with the statistics, as text unless JSON was asked for */
+    if (options->hardware_counters && options->stats == stats_off) {
+        options->stats = stats_text;
     }
     return 0;
 }
@@ -5,32 +5,18 @@
 #ifndef MAIN_H
 #define MAIN_H
 
-<<<<<<< HEAD
 /* Included necessary library */
-=======
-#include "stages/preProcessor/macro_Handling.h"
-#include "stages/preProcessor/macro_validation.h"
-#include "stages/lineAnalyzer/line_recognizer.h"
-#include "stages/utils/utils.h"
-#include "stages/utils/struct.h"
->>>>>>> 389b960335faa1dd26beee952d443d9d0b53411c
 #include <stdio.h>
+#include "utils.h"
 
-/* Function prototype */
-int process_file(char *filename);
+/* Command-line flags */
+#define NO_AM_FLAG "--no-am"
+#define JOBS_FLAG "--jobs"
+#define BINARY_FLAG "--binary"
+#define CACHE_DIR_FLAG "--cache-dir"
 
-<<<<<<< HEAD
-#endif 
-=======
-static struct SymbolTableManager symbolManager = {0}; 
-
-/* Function Prototypes */
+/* Function prototypes */
+int process_file(char *filename, const struct assembler_options *options);
+int parse_arguments(int argc, char **argv, struct assembler_options *options, char **filenames, int *files_count);
 
-int firstStage(struct SymbolTableManager* symbolManager, LineInfo* head); 
-int secondStage(struct SymbolTableManager* symbolManager, LineInfo* head);
-void printGeneratedCode(struct SymbolTableManager* symbolManager);
-void processFiles(int argc, char *argv[]); /* Processes each file provided in the command-line arguments.*/
-void processExpandedFile(const char *filename); /*Processes the expanded file to recognize and handle each sentence type.*/
-
-#endif /* MAIN_H */
->>>>>>> 389b960335faa1dd26beee952d443d9d0b53411c
+#endif 
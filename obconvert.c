@@ -0,0 +1,244 @@
+/*
+ * This file contains the object converter shipped with the assembler.
+ * A binary object (.obin) is converted to the textual .ob file, with the .ent and .ext files
+ * of its entries and externals tables, and a textual .ob file is converted back to a binary object
+ * together with the .ent and .ext files found next to it.
+ * Binary objects are mapped into memory and read without a copy of the file, their words and
+ * tables are decoded from the mapping into arrays of their own.
+ */
+
+#include "object_format.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Function to build the path of a sibling file by replacing the extension of a path */
+static char *replace_extension(const char *path, const char *from, const char *to) {
+    int base_length = strlen(path) - strlen(from);
+    char *new_path = malloc(base_length + strlen(to) + 1);
+
+    if (new_path == NULL) {
+        fprintf(stderr, "[ERROR] Out of memory, aborting.\n");
+        exit(1);
+    }
+    memcpy(new_path, path, base_length);
+    strcpy(new_path + base_length, to);
+    return new_path;
+}
+
+/* Function to check if a path ends with an extension */
+static int has_extension(const char *path, const char *extension) {
+    int path_length = strlen(path);
+    int extension_length = strlen(extension);
+    return path_length > extension_length && strcmp(path + path_length - extension_length, extension) == 0;
+}
+
+/* Function to write a whole buffer to a new file */
+static int write_whole_file(const char *path, const void *buffer, int length) {
+    FILE *file = fopen(path, MODE_WRITE);
+
+    if (file == NULL) {
+        fprintf(stderr, "Error: Unable to create file: %s\n", path);
+        return ERROR;
+    }
+    if (fwrite(buffer, 1, length, file) != (size_t)length) {
+        fprintf(stderr, "Error: Failed to write file: %s\n", path);
+        fclose(file);
+        return ERROR;
+    }
+    fclose(file);
+    return 0;
+}
+
+/* Function to write the symbols of a table as lines of a textual .ent or .ext file */
+static int write_symbols_file(const char *path, const char *format, const struct object_symbol *symbols, int count) {
+    FILE *file = fopen(path, MODE_WRITE);
+    int i;
+
+    if (file == NULL) {
+        fprintf(stderr, "Error: Unable to create file: %s\n", path);
+        return ERROR;
+    }
+    for (i = 0; i < count; i++) {
+        fprintf(file, format, symbols[i].name, symbols[i].address);
+    }
+    fclose(file);
+    return 0;
+}
+
+/* Function to read the symbols of a textual .ent or .ext file, a missing file has no symbols */
+static int read_symbols_file(const char *path, const char *format, struct object_symbol **symbols) {
+    char line[MAX_LENGTH];
+    struct object_symbol *resized;
+    FILE *file;
+    int capacity = 0;
+    int count = 0;
+
+    *symbols = NULL;
+    file = fopen(path, MODE_READ);
+    if (file == NULL) {
+        return 0;
+    }
+    while (fgets(line, sizeof(line), file)) {
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : MIN_INDEX_CAPACITY;
+            resized = realloc(*symbols, capacity * sizeof(**symbols));
+            if (resized == NULL) {
+                fprintf(stderr, "[ERROR] Out of memory, aborting.\n");
+                exit(1);
+            }
+            *symbols = resized;
+        }
+        if (sscanf(line, format, (*symbols)[count].name, &(*symbols)[count].address) == 2) {
+            count++;
+        }
+    }
+    fclose(file);
+    return count;
+}
+
+/* Function to convert a binary object to the textual .ob, .ent and .ext files */
+static int binary_to_text(const char *path) {
+    struct object_image image;
+    struct stat file_stat;
+    void *mapping;
+    char *text;
+    char *output_path;
+    int length;
+    int descriptor;
+    int result = 0;
+
+    /* Map the binary object, it is read once from start to end */
+    descriptor = open(path, O_RDONLY);
+    if (descriptor < 0 || fstat(descriptor, &file_stat) != 0) {
+        fprintf(stderr, "Error: Unable to open file: %s\n", path);
+        if (descriptor >= 0) close(descriptor);
+        return ERROR;
+    }
+    mapping = file_stat.st_size > 0 ? mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, descriptor, 0) : MAP_FAILED;
+    close(descriptor);
+    if (mapping == MAP_FAILED || decode_binary_object(mapping, file_stat.st_size, &image) != 0) {
+        fprintf(stderr, "Error: Not a binary object file: %s\n", path);
+        if (mapping != MAP_FAILED) munmap(mapping, file_stat.st_size);
+        return ERROR;
+    }
+    munmap(mapping, file_stat.st_size);
+
+    /* Write the textual object */
+    text = format_text_object(&image, &length);
+    output_path = replace_extension(path, BINARY_OBJ_FILE_TYPE, OBJ_FILE_TYPE);
+    result = write_whole_file(output_path, text, length);
+    free(output_path);
+    free(text);
+
+    /* Write the entries and externals tables when the object has them */
+    if (result == 0 && image.entries_count > 0) {
+        output_path = replace_extension(path, BINARY_OBJ_FILE_TYPE, ENT_FILE_TYPE);
+        result = write_symbols_file(output_path, "%s:\t%d\n", image.entries, image.entries_count);
+        free(output_path);
+    }
+    if (result == 0 && image.externals_count > 0) {
+        output_path = replace_extension(path, BINARY_OBJ_FILE_TYPE, EXT_FILE_TYPE);
+        result = write_symbols_file(output_path, "%s\t%d\n", image.externals, image.externals_count);
+        free(output_path);
+    }
+
+    free_decoded_object(&image);
+    return result;
+}
+
+/* Function to convert a textual .ob file and its .ent and .ext files to a binary object */
+static int text_to_binary(const char *path) {
+    struct object_image image = {0};
+    unsigned int word;
+    unsigned char *bytes;
+    char line[MAX_LENGTH];
+    char *symbols_path;
+    uint16_t *words;
+    int address;
+    int length;
+    int count;
+    int result;
+    FILE *file;
+
+    file = fopen(path, MODE_READ);
+    if (file == NULL) {
+        fprintf(stderr, "Error: Unable to open file: %s\n", path);
+        return ERROR;
+    }
+
+    /* Read the sizes of the code and data sections, then every word line */
+    if (!fgets(line, sizeof(line), file) || sscanf(line, "%d %d", &image.code_size, &image.data_size) != 2 ||
+        image.code_size < 0 || image.data_size < 0) {
+        fprintf(stderr, "Error: Not an object file: %s\n", path);
+        fclose(file);
+        return ERROR;
+    }
+    words = malloc((image.code_size + image.data_size + 1) * sizeof(*words));
+    if (words == NULL) {
+        fprintf(stderr, "[ERROR] Out of memory, aborting.\n");
+        exit(1);
+    }
+    for (count = 0; count < image.code_size + image.data_size; count++) {
+        if (!fgets(line, sizeof(line), file) || sscanf(line, "%d %o", &address, &word) != 2) {
+            fprintf(stderr, "Error: Truncated object file: %s\n", path);
+            free(words);
+            fclose(file);
+            return ERROR;
+        }
+        if (count == 0) {
+            image.base_address = address;
+        }
+        words[count] = TO_WORD(word);
+    }
+    fclose(file);
+    image.code = words;
+    image.data = words + image.code_size;
+    if (count == 0) {
+        image.base_address = INIT_ADDRESS;
+    }
+
+    /* Read the entries and externals next to the object */
+    symbols_path = replace_extension(path, OBJ_FILE_TYPE, ENT_FILE_TYPE);
+    image.entries_count = read_symbols_file(symbols_path, "%31[^:]:%d", &image.entries);
+    free(symbols_path);
+    symbols_path = replace_extension(path, OBJ_FILE_TYPE, EXT_FILE_TYPE);
+    image.externals_count = read_symbols_file(symbols_path, "%31s%d", &image.externals);
+    free(symbols_path);
+
+    /* Encode and write the binary object */
+    bytes = encode_binary_object(&image, &length);
+    symbols_path = replace_extension(path, OBJ_FILE_TYPE, BINARY_OBJ_FILE_TYPE);
+    result = write_whole_file(symbols_path, bytes, length);
+
+    free(symbols_path);
+    free(bytes);
+    free(words);
+    free(image.entries);
+    free(image.externals);
+    return result;
+}
+
+/* Main function to convert each object file given on the command line by its extension */
+int main(int argc, char **argv) {
+    int status = 0;
+    int i;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s file%s|file%s...\n", argv[0], BINARY_OBJ_FILE_TYPE, OBJ_FILE_TYPE);
+        return 1;
+    }
+
+    for (i = 1; i < argc; i++) {
+        if (has_extension(argv[i], BINARY_OBJ_FILE_TYPE)) {
+            status |= binary_to_text(argv[i]) != 0;
+        } else if (has_extension(argv[i], OBJ_FILE_TYPE)) {
+            status |= text_to_binary(argv[i]) != 0;
+        } else {
+            fprintf(stderr, "Error: Unknown object file type: %s\n", argv[i]);
+            status = 1;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,207 @@
+/*
+ * This file implements the encodings of an assembled object, the textual .ob format
+ * and the compact binary object format described in object_format.h.
+ * It only formats and parses memory buffers, writing and mapping the files is left to the callers.
+ */
+
+#include "object_format.h"
+
+/* Table of the five octal digits of every 15 bit word, built once */
+static char octal_words[NUMBER_OF_WORDS][OCTAL_WORD_DIGITS];
+static pthread_once_t octal_words_once = PTHREAD_ONCE_INIT;
+
+/* Function to build the octal digits table, runs once */
+static void build_octal_words(void) {
+    int word;
+    int i;
+
+    for (word = 0; word < NUMBER_OF_WORDS; word++) {
+        for (i = 0; i < OCTAL_WORD_DIGITS; i++) {
+            octal_words[word][i] = '0' + ((word >> (3 * (OCTAL_WORD_DIGITS - 1 - i))) & 0x7);
+        }
+    }
+}
+
+/* Function to store a 16 bit little-endian field */
+static void put_field(unsigned char *bytes, int value) {
+    bytes[0] = value & 0xFF;
+    bytes[1] = (value >> 8) & 0xFF;
+}
+
+/* Function to load a 16 bit little-endian field */
+static int get_field(const unsigned char *bytes) {
+    return bytes[0] | (bytes[1] << 8);
+}
+
+/* Function to allocate a buffer, aborting when out of memory */
+static void *allocate(size_t size) {
+    void *buffer = malloc(size > 0 ? size : 1);
+    if (buffer == NULL) {
+        fprintf(stderr, "[ERROR] Out of memory, aborting.\n");
+        exit(1);
+    }
+    return buffer;
+}
+
+/* Function to format the object file line of a word at an address into buffer, returns the line length.
+ * The address is zero padded to four digits, the code and data limits keep it below 10000 */
+int format_object_word(char *buffer, int address, int word) {
+    int i;
+
+    pthread_once(&octal_words_once, build_octal_words);
+
+    for (i = ADDRESS_DIGITS - 1; i >= 0; i--) {
+        buffer[i] = '0' + address % 10;
+        address /= 10;
+    }
+    buffer[ADDRESS_DIGITS] = ' ';
+    memcpy(buffer + ADDRESS_DIGITS + 1, octal_words[word & WORD_MASK], OCTAL_WORD_DIGITS);
+    buffer[OBJECT_LINE_LENGTH - 1] = '\n';
+    return OBJECT_LINE_LENGTH;
+}
+
+/* Function to format the whole textual object into a new buffer, every word line has the same length */
+char *format_text_object(const struct object_image *image, int *length) {
+    char *text;
+    int address;
+    int i;
+
+    text = allocate(MAX_OBJECT_HEADER_LENGTH + (image->code_size + image->data_size) * OBJECT_LINE_LENGTH);
+
+    /* Write the sizes of code and data sections */
+    *length = sprintf(text, "  %d %d\n", image->code_size, image->data_size);
+
+    address = image->base_address;
+
+    /* Write the code section */
+    for (i = 0; i < image->code_size; i++, address++) {
+        *length += format_object_word(text + *length, address, image->code[i]);
+    }
+
+    /* Write the data section */
+    for (i = 0; i < image->data_size; i++, address++) {
+        *length += format_object_word(text + *length, address, image->data[i]);
+    }
+
+    return text;
+}
+
+/* Function to encode the symbol records of a binary object table, returns the position after them */
+static int encode_symbols(unsigned char *bytes, int position, const struct object_symbol *symbols, int count) {
+    int i;
+
+    for (i = 0; i < count; i++, position += BINARY_SYMBOL_SIZE) {
+        put_field(bytes + position, symbols[i].address);
+        memset(bytes + position + 2, 0, OBJECT_NAME_LENGTH);
+        strncpy((char *)bytes + position + 2, symbols[i].name, OBJECT_NAME_LENGTH - 1);
+    }
+    return position;
+}
+
+/* Function to encode the binary object into a new buffer, the tables are only written when not empty */
+unsigned char *encode_binary_object(const struct object_image *image, int *length) {
+    unsigned char *bytes;
+    int flags = 0;
+    int position;
+    int i;
+
+    *length = BINARY_HEADER_SIZE + (image->code_size + image->data_size) * 2 +
+              (image->entries_count + image->externals_count) * BINARY_SYMBOL_SIZE;
+    bytes = allocate(*length);
+
+    if (image->entries_count > 0) {
+        flags |= BINARY_HAS_ENTRIES;
+    }
+    if (image->externals_count > 0) {
+        flags |= BINARY_HAS_EXTERNALS;
+    }
+
+    /* Write the header */
+    memcpy(bytes, BINARY_MAGIC, BINARY_MAGIC_LENGTH);
+    put_field(bytes + 4, BINARY_VERSION);
+    put_field(bytes + 6, flags);
+    put_field(bytes + 8, image->base_address);
+    put_field(bytes + 10, image->code_size);
+    put_field(bytes + 12, image->data_size);
+    put_field(bytes + 14, image->entries_count);
+    put_field(bytes + 16, image->externals_count);
+    put_field(bytes + 18, 0);
+
+    /* Write the code and data words */
+    position = BINARY_HEADER_SIZE;
+    for (i = 0; i < image->code_size; i++, position += 2) {
+        put_field(bytes + position, image->code[i]);
+    }
+    for (i = 0; i < image->data_size; i++, position += 2) {
+        put_field(bytes + position, image->data[i]);
+    }
+
+    /* Write the entries and externals tables */
+    position = encode_symbols(bytes, position, image->entries, image->entries_count);
+    encode_symbols(bytes, position, image->externals, image->externals_count);
+    return bytes;
+}
+
+/* Function to decode the symbol records of a binary object table into a new array */
+static struct object_symbol *decode_symbols(const unsigned char *bytes, int count) {
+    struct object_symbol *symbols = allocate(count * sizeof(*symbols));
+    int i;
+
+    for (i = 0; i < count; i++, bytes += BINARY_SYMBOL_SIZE) {
+        symbols[i].address = get_field(bytes);
+        memcpy(symbols[i].name, bytes + 2, OBJECT_NAME_LENGTH);
+        symbols[i].name[OBJECT_NAME_LENGTH - 1] = '\0';
+    }
+    return symbols;
+}
+
+/* Function to decode a binary object of the given size into an image owning its arrays.
+ * Returns ERROR when the bytes are not a binary object of a supported version */
+int decode_binary_object(const unsigned char *bytes, long size, struct object_image *image) {
+    uint16_t *words;
+    int flags;
+    long position;
+    int i;
+
+    if (size < BINARY_HEADER_SIZE || memcmp(bytes, BINARY_MAGIC, BINARY_MAGIC_LENGTH) != 0 ||
+        get_field(bytes + 4) != BINARY_VERSION) {
+        return ERROR;
+    }
+
+    memset(image, 0, sizeof(*image));
+    flags = get_field(bytes + 6);
+    image->base_address = get_field(bytes + 8);
+    image->code_size = get_field(bytes + 10);
+    image->data_size = get_field(bytes + 12);
+    image->entries_count = (flags & BINARY_HAS_ENTRIES) ? get_field(bytes + 14) : 0;
+    image->externals_count = (flags & BINARY_HAS_EXTERNALS) ? get_field(bytes + 16) : 0;
+
+    /* The sizes in the header must match the size of the object */
+    if (size != BINARY_HEADER_SIZE + (long)(image->code_size + image->data_size) * 2 +
+                (long)(image->entries_count + image->externals_count) * BINARY_SYMBOL_SIZE) {
+        return ERROR;
+    }
+
+    /* Read the code and data words */
+    words = allocate((image->code_size + image->data_size) * sizeof(*words));
+    position = BINARY_HEADER_SIZE;
+    for (i = 0; i < image->code_size + image->data_size; i++, position += 2) {
+        words[i] = TO_WORD(get_field(bytes + position));
+    }
+    image->code = words;
+    image->data = words + image->code_size;
+
+    /* Read the entries and externals tables */
+    image->entries = decode_symbols(bytes + position, image->entries_count);
+    position += (long)image->entries_count * BINARY_SYMBOL_SIZE;
+    image->externals = decode_symbols(bytes + position, image->externals_count);
+    return 0;
+}
+
+/* Function to release the arrays of an image filled by decode_binary_object */
+void free_decoded_object(struct object_image *image) {
+    free((uint16_t *)image->code);
+    free(image->entries);
+    free(image->externals);
+    memset(image, 0, sizeof(*image));
+}
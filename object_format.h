@@ -0,0 +1,55 @@
+/*
+ * This header file declares the encodings of an assembled object.
+ * An object is written either as the textual .ob file or as a compact binary object,
+ * both are produced from the same object image so the assembler and the converter agree on them.
+ *
+ * The binary object is made of little-endian 16 bit fields, so it can be mapped and read in place:
+ *   header    magic "AOBJ", version, flags, base address, code size, data size,
+ *             entries count, externals count and a reserved field, BINARY_HEADER_SIZE bytes
+ *   words     the code words then the data words, 15 bit values in 16 bit fields
+ *   entries   when BINARY_HAS_ENTRIES is set, a 16 bit address and a zero padded name for each entry
+ *   externals when BINARY_HAS_EXTERNALS is set, the same records for each external reference
+ */
+
+#ifndef OBJECT_FORMAT_H
+#define OBJECT_FORMAT_H
+
+/* Included necessary header file */
+#include "utils.h"
+
+#define BINARY_MAGIC "AOBJ"
+#define BINARY_MAGIC_LENGTH 4
+#define BINARY_VERSION 1
+#define BINARY_HEADER_SIZE 20
+#define BINARY_HAS_ENTRIES 1
+#define BINARY_HAS_EXTERNALS 2
+#define OBJECT_NAME_LENGTH 32
+#define BINARY_SYMBOL_SIZE (2 + OBJECT_NAME_LENGTH)
+
+/* Structure representing a named address of an object, an entry or a reference to an external */
+struct object_symbol {
+    char name[OBJECT_NAME_LENGTH];
+    int address;
+};
+
+/* Structure representing an assembled object, its entries and externals are listed in output order */
+struct object_image {
+    int base_address;
+    const uint16_t *code;
+    int code_size;
+    const uint16_t *data;
+    int data_size;
+    struct object_symbol *entries;
+    int entries_count;
+    struct object_symbol *externals;
+    int externals_count;
+};
+
+/* Function declarations */
+int format_object_word(char *buffer, int address, int word);
+char *format_text_object(const struct object_image *image, int *length);
+unsigned char *encode_binary_object(const struct object_image *image, int *length);
+int decode_binary_object(const unsigned char *bytes, long size, struct object_image *image);
+void free_decoded_object(struct object_image *image);
+
+#endif
@@ -1,27 +1,43 @@
 /*
  * This file implements the preprocessor for our assembly language.
  * It handles macro definitions and expansions in the input file, 
- * and generating an output file.
+ * keeping the expanded source in memory and optionally writing it to an output file.
  * it prepares the assembly code for the next stages.
  */
 
 #include "pre_processor.h"
 
-/* Function to process the input file and generate a macro-expanded output file */
-char* preProcessor(const char* inputFilename) {
-    char fileBuffer[MAX_LENGTH] = {0};
-    char *commentMarker, *quoteStartPtr, *quoteEndPtr;
+/* Function to find the last occurrence of a character in a span of text, NULL when there is none */
+static const char *find_last_char(const char *text, int length, char character) {
+    while (length-- > 0) {
+        if (text[length] == character) {
+            return text + length;
+        }
+    }
+    return NULL;
+}
+
+/* Function to process the input file into a macro-expanded source buffer.
+ * The source is mapped into memory and its lines are walked in place. A line longer than
+ * MAX_LINE_LENGTH characters, or a macro named after a reserved word or with a name too long, is an error and the file isn't expanded.
+ * The expanded source is also written to the .am file when write_am is set. */
+char* preProcessor(const char* inputFilename, struct source_buffer *expanded, bool write_am) {
+    struct mapped_source source;
+    const char *line, *nullCharacter;
+    const char *commentMarker, *quoteStartPtr, *quoteEndPtr;
     char *sourceFileName, *macroFileName;
-    int lineCounter = 1;
-    FILE *sourceFile, *macroFile;
+    int lineLength, contentLength;
+    int lineCounter;
+    int expansionCounter = 0;
+    bool failed = false;
+    FILE *macroFile = NULL;
     MacroTableDef macroTable = {0};
     MacroDef* activeMacro = NULL;
-    int i;
 
     /* Allocate memory for source and macro filenames */
     sourceFileName = (char *)malloc(strlen(inputFilename) + 4);
     if (sourceFileName == NULL) {
-        printf("Memory allocation failed for assembly file name.\n");
+        report(stdout, "Memory allocation failed for assembly file name.\n");
         return NULL;
     }
     strcpy(sourceFileName, inputFilename);
@@ -29,39 +45,56 @@ char* preProcessor(const char* inputFilename) {
 
     macroFileName = (char *)malloc(strlen(inputFilename) + 4); 
     if (macroFileName == NULL) {
-        printf("Memory allocation failed for extracted file name.\n");
+        report(stdout, "Memory allocation failed for extracted file name.\n");
         free(sourceFileName);
         return NULL;
     }
     strcpy(macroFileName, inputFilename);
     strcat(macroFileName, UNPACKED_FILE_EXT);
 
-    /* Open source and macro files */
-    sourceFile = fopen(sourceFileName, MODE_READ);
-    macroFile = fopen(macroFileName, MODE_WRITE);
-    
-    /* Check if file opening was successful */
-    if (!sourceFile || !macroFile) {
-        printf("Failed to open files: %s or %s.\n", sourceFileName, macroFileName);
+    /* Map the source file */
+    if (map_source_file(sourceFileName, &source) != 0) {
+        report(stdout, "Failed to open files: %s or %s.\n", sourceFileName, macroFileName);
         free(macroFileName);
         free(sourceFileName);
         return NULL;
     }
     
-    /* Read each line from the source file */
-    while (fgets(fileBuffer, sizeof(fileBuffer), sourceFile)) {
-        LineCategory lineType = categorize_line(fileBuffer, &macroTable, &activeMacro);
-        commentMarker = strchr(fileBuffer, COMMENT_PREFIX);
+    /* Walk each line of the source file in place */
+    for (lineCounter = 1; lineCounter <= source.lines_count; lineCounter++) {
+        LineCategory lineType;
+
+        line = source.text + source.line_offsets[lineCounter - 1];
+        lineLength = source.line_offsets[lineCounter] - source.line_offsets[lineCounter - 1];
+
+        /* The text of a line ends at a null character, as it did when lines were read as strings */
+        nullCharacter = memchr(line, '\0', lineLength);
+        if (nullCharacter) {
+            lineLength = nullCharacter - line;
+        }
+
+        /* A line too long for the language is reported instead of being cut, its line ending doesn't count */
+        contentLength = lineLength;
+        if (contentLength > 0 && line[contentLength - 1] == '\n') contentLength--;
+        if (contentLength > 0 && line[contentLength - 1] == '\r') contentLength--;
+        if (contentLength > MAX_LINE_LENGTH) {
+            report(stdout, "Line %d: Line is longer than %d characters.\n", lineCounter, MAX_LINE_LENGTH);
+            failed = true;
+            continue;
+        }
+
+        lineType = categorize_line(line, lineLength, &macroTable, &activeMacro);
+        commentMarker = memchr(line, COMMENT_PREFIX, lineLength);
         if (commentMarker) {
-            quoteStartPtr = strchr(fileBuffer, DOUBLE_QUOTE);
+            quoteStartPtr = memchr(line, DOUBLE_QUOTE, lineLength);
             if (quoteStartPtr) {
-                quoteEndPtr = strrchr(fileBuffer, DOUBLE_QUOTE);
+                quoteEndPtr = find_last_char(line, lineLength, DOUBLE_QUOTE);
                 /* Check if comment is outside the quoted text */
                 if (commentMarker > quoteEndPtr || commentMarker < quoteStartPtr) {
-                    *commentMarker = '\0';  /* Null-terminate the line at comment start */
+                    lineLength = commentMarker - line;  /* End the line at comment start */
                 }
             } else {
-                *commentMarker = '\0';  /* Null-terminate the line at comment start */
+                lineLength = commentMarker - line;  /* End the line at comment start */
             }
         }
 
@@ -70,73 +103,186 @@ char* preProcessor(const char* inputFilename) {
         }
         else if (lineType == ERROR_NO_NAME) {
             /* Error: missing macro name */
-            printf("Line %d: No macro name specified after 'macr'.\n", lineCounter);
+            report(stdout, "Line %d: No macro name specified after 'macr'.\n", lineCounter);
         }
         else if (lineType == ERROR_ALREADY_DEFINED) {
             /* Error: macro already defined */
-            printf("Line %d: Macro '%s' already defined.\n", lineCounter, activeMacro->macroName);
+            report(stdout, "Line %d: Macro '%s' already defined.\n", lineCounter, activeMacro->macroName);
             activeMacro = NULL;  /* Reset active macro */
         }
+        else if (lineType == ERROR_RESERVED_NAME) {
+            /* Error: macro named after a reserved word */
+            report(stdout, "Line %d: Macro name after 'macr' is a reserved word.\n", lineCounter);
+            failed = true;
+        }
+        else if (lineType == ERROR_LONG_NAME) {
+            /* Error: macro name too long */
+            report(stdout, "Line %d: Macro name after 'macr' is longer than %d characters.\n", lineCounter, MACRO_MAX_SIZE - 1);
+            failed = true;
+        }
         else if (lineType == END_MACRO) {
             /* End of macro definition */
             activeMacro = NULL;  /* Reset active macro */
         }
         else if (lineType == CALL_MACRO) {
-            /* Macro invocation */
-            for (i = 0; i < activeMacro->lineTotal; i++) {
-                fputs(activeMacro->macroContent[i], macroFile);
-            }
+            /* Macro invocation, the whole body is written at once */
+            append_source_text(expanded, macroTable.bodyArena + activeMacro->bodyOffset, activeMacro->bodyLength);
+            expansionCounter++;
             activeMacro = NULL;  /* Reset active macro */
         }
         else if (lineType == NORMAL_LINE) {
             /* Regular line handling */
             if (activeMacro) {
                 /* Store line in macro content if within a macro */
-                strcpy(activeMacro->macroContent[activeMacro->lineTotal], fileBuffer);
-                activeMacro->lineTotal++;
+                append_macro_line(&macroTable, activeMacro, line, lineLength);
             } else {
-                /* Write line directly to output file */
-                fputs(fileBuffer, macroFile);
+                /* Append line directly to the expanded source */
+                append_source_text(expanded, line, lineLength);
             }
         }
         else if (lineType == BLANK_LINE) {
             /* Blank line handling */
         }
-        lineCounter++;  /* Increment line counter */
     }
-    
-    /* Close files and free allocated memory */
-    fclose(macroFile);
-    fclose(sourceFile);
+    add_stat(counter_lines_read, source.lines_count);
+    add_stat(counter_macro_expansions, expansionCounter);
+    unmap_source_file(&source);
+    free_macro_table(&macroTable);
+
+    /* A file with one of these errors isn't expanded and gets no .am file */
+    if (!failed && write_am) {
+        macroFile = fopen(macroFileName, MODE_WRITE);
+        if (!macroFile) {
+            report(stdout, "Failed to open files: %s or %s.\n", sourceFileName, macroFileName);
+        }
+    }
     free(sourceFileName);
+    if (failed || (write_am && !macroFile)) {
+        free(macroFileName);
+        return NULL;
+    }
+
+    /* Index the lines of the expanded source for the next stages, a line keeps its line ending of up to two characters */
+    index_source_lines(expanded, MAX_LINE_LENGTH + 2);
+
+    /* Write the whole expanded source to the .am file at once */
+    if (macroFile) {
+        if (expanded->text_size > 0) {
+            fwrite(expanded->text, 1, expanded->text_size, macroFile);
+        }
+        fclose(macroFile);
+        add_stat(counter_bytes_written, expanded->text_size);
+    }
     return macroFileName;
 }
 
 /* Function to locate a macro by name within a macro table */
 MacroDef* locate_macro(const MacroTableDef* macroTable, const char* macroName) {
-    int index;
-    for (index = 0; index < macroTable->macroCount; index++) {
-        /* Compare macro names to find a match */
-        if (strcmp(macroTable->macroList[index].macroName, macroName) == 0) {
-            return (MacroDef*)&macroTable->macroList[index];
+    unsigned long hash, slot;
+    const MacroDef* macro;
+
+    /* Fast path for the common case of a file without macros */
+    if (macroTable->macroCount == 0) {
+        return NULL;
+    }
+
+    /* Probe the index until an empty slot, comparing names only when the hashes match */
+    hash = hash_name(macroName, strlen(macroName));
+    slot = hash & (macroTable->indexCapacity - 1);
+    while (macroTable->macroIndex[slot] != 0) {
+        macro = &macroTable->macroList[macroTable->macroIndex[slot] - 1];
+        if (macro->nameHash == hash && strcmp(macro->macroName, macroName) == 0) {
+            return (MacroDef*)macro;
         }
+        slot = (slot + 1) & (macroTable->indexCapacity - 1);
     }
     /* Return NULL if no macro is found */
     return NULL;
 }
 
+/* Function to add a new macro with an empty body to the macro table and its index */
+MacroDef* add_macro(MacroTableDef* macroTable, const char* macroName) {
+    MacroDef* macro;
+    unsigned long slot;
+
+    macroTable->macroList = grow_array(macroTable->macroList, &macroTable->macroCapacity,
+                                       macroTable->macroCount + 1, sizeof(*macroTable->macroList));
+    macro = &macroTable->macroList[macroTable->macroCount];
+    strcpy(macro->macroName, macroName);
+    macro->nameHash = hash_name(macroName, strlen(macroName));
+    macro->bodyOffset = macroTable->arenaSize;
+    macro->bodyLength = 0;
+    macroTable->macroCount++;
+
+    /* Keep the index at most half full, the rebuild also inserts the new macro */
+    if (macroTable->macroCount * 2 > macroTable->indexCapacity) {
+        rebuild_macro_index(macroTable, macroTable->indexCapacity > 0 ? macroTable->indexCapacity * 2 : MIN_INDEX_CAPACITY);
+    } else {
+        slot = macro->nameHash & (macroTable->indexCapacity - 1);
+        while (macroTable->macroIndex[slot] != 0) {
+            slot = (slot + 1) & (macroTable->indexCapacity - 1);
+        }
+        macroTable->macroIndex[slot] = macroTable->macroCount;
+    }
+    return macro;
+}
+
+/* Function to rebuild the macro index with a power of two capacity */
+void rebuild_macro_index(MacroTableDef* macroTable, int capacity) {
+    unsigned long slot;
+    int index;
+
+    free(macroTable->macroIndex);
+    macroTable->macroIndex = calloc(capacity, sizeof(*macroTable->macroIndex));
+    if (macroTable->macroIndex == NULL) {
+        fprintf(stderr, "[ERROR] Out of memory, aborting.\n");
+        exit(1);
+    }
+    macroTable->indexCapacity = capacity;
+
+    for (index = 0; index < macroTable->macroCount; index++) {
+        slot = macroTable->macroList[index].nameHash & (capacity - 1);
+        while (macroTable->macroIndex[slot] != 0) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        macroTable->macroIndex[slot] = index + 1;
+    }
+}
+
+/* Function to append a line to the body of the macro being defined.
+ * Macros are defined one at a time, so the body always ends at the end of the arena. */
+void append_macro_line(MacroTableDef* macroTable, MacroDef* macro, const char* line, int length) {
+    macroTable->bodyArena = grow_array(macroTable->bodyArena, &macroTable->arenaCapacity,
+                                       macroTable->arenaSize + length, sizeof(*macroTable->bodyArena));
+    memcpy(macroTable->bodyArena + macroTable->arenaSize, line, length);
+    macroTable->arenaSize += length;
+    macro->bodyLength += length;
+}
+
+/* Function to release the memory of a macro table */
+void free_macro_table(MacroTableDef* macroTable) {
+    free(macroTable->bodyArena);
+    free(macroTable->macroIndex);
+    free(macroTable->macroList);
+    memset(macroTable, 0, sizeof(*macroTable));
+}
+
 /* Function to categorize line type and process macros */
-LineCategory categorize_line(char* inputLine, MacroTableDef* macroTable, MacroDef** foundMacro) {
+LineCategory categorize_line(const char* line, int length, MacroTableDef* macroTable, MacroDef** foundMacro) {
     char tempLine[MAX_LENGTH] = {0};
-    char *spacePtr = NULL, *endPtr = NULL;
+    char *inputLine, *spacePtr = NULL, *endPtr = NULL;
 
     /* Skip leading whitespace */
-    while (isspace(*inputLine)) {
-        inputLine++;
+    while (length > 0 && isspace(*line)) {
+        line++;
+        length--;
     }
 
-    /* Copy input line to a temporary buffer for processing */
-    strcpy(tempLine, inputLine);
+    /* Copy input line to a temporary buffer for processing, the line ending may not fit and is dropped below anyway */
+    if (length >= (int)sizeof(tempLine)) {
+        length = sizeof(tempLine) - 1;
+    }
+    memcpy(tempLine, line, length);
     inputLine = tempLine;
     /* Remove newline characters from the line */
     inputLine[strcspn(inputLine, "\r\n")] = '\0';
@@ -169,14 +315,24 @@ LineCategory categorize_line(char* inputLine, MacroTableDef* macroTable, MacroDe
             *endPtr = '\0';  /* Null-terminate at the first boundary */
         }
         
+        /* A name that doesn't fit in the macro table is an error */
+        if (strlen(inputLine) >= MACRO_MAX_SIZE) {
+            *foundMacro = NULL;
+            return ERROR_LONG_NAME;
+        }
+
+        /* Reserved words of the language can't name a macro */
+        if (is_reserved_word(inputLine, strlen(inputLine))) {
+            *foundMacro = NULL;
+            return ERROR_RESERVED_NAME;
+        }
+
         *foundMacro = locate_macro(macroTable, inputLine);
         if (*foundMacro) {
             return ERROR_ALREADY_DEFINED;  /* Return error if macro is already defined */
         } else {
             /* Add new macro to the table */
-            strcpy(macroTable->macroList[macroTable->macroCount].macroName, inputLine);
-            *foundMacro = &macroTable->macroList[macroTable->macroCount];
-            macroTable->macroCount++;
+            *foundMacro = add_macro(macroTable, inputLine);
             return DEFINE_MACRO;  /* Return macro define type */
         }
     }
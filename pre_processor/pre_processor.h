@@ -8,6 +8,8 @@
 
 /* include of necessary header file */
 #include "../utils.h"
+#include "../line_interpreter.h"
+#include "../stats.h"
 
 /* Enumeration for categorizing different types of lines in input */
 typedef enum {
@@ -17,24 +19,39 @@ typedef enum {
     END_MACRO,              
     CALL_MACRO,           
     ERROR_NO_NAME,          
-    ERROR_ALREADY_DEFINED   
+    ERROR_ALREADY_DEFINED,
+    ERROR_RESERVED_NAME,
+    ERROR_LONG_NAME
 } LineCategory;
 
-/* Structure representing a single macro definition */
+/* Structure representing a single macro definition, its body is a span of the table's body arena */
 typedef struct {
     char macroName[MACRO_MAX_SIZE];         
-    char macroContent[MAX_LINES][MAX_LENGTH];  
-    int lineTotal;              
+    int bodyOffset;
+    int bodyLength;
+    unsigned long nameHash;
 } MacroDef;
 
-/* Structure for a table of macros, storing all macro definitions */
+/* Structure for a table of macros, storing all macro definitions.
+ * The bodies of all macros are stored one after another in bodyArena.
+ * macroIndex is an open addressing hash index holding macroList positions plus one, 0 marks an empty slot. */
 typedef struct {
-    MacroDef macroList[MAX_MAC_FOUND];   
+    MacroDef *macroList;   
     int macroCount;             
+    int macroCapacity;
+    int *macroIndex;
+    int indexCapacity;
+    char *bodyArena;
+    int arenaSize;
+    int arenaCapacity;
 } MacroTableDef;
 
 /* Function declarations */
 MacroDef* locate_macro(const MacroTableDef* macroTable, const char* macroName);
-LineCategory categorize_line(char* inputLine, MacroTableDef* macroTable, MacroDef** foundMacro);
+MacroDef* add_macro(MacroTableDef* macroTable, const char* macroName);
+void rebuild_macro_index(MacroTableDef* macroTable, int capacity);
+void append_macro_line(MacroTableDef* macroTable, MacroDef* macro, const char* line, int length);
+void free_macro_table(MacroTableDef* macroTable);
+LineCategory categorize_line(const char* line, int length, MacroTableDef* macroTable, MacroDef** foundMacro);
 
 #endif 
@@ -3,165 +3,181 @@
  * It continues the process of the assembly file, generating machine code for instructions
  * and handling data directives.
  * The second stage focuses on converting the processed assembly code into machine code.
- * It reads the assembly file line by line, generates appropriate binary representations
- * for instructions and data, and handles symbol references.
+ * It walks the line records kept by the first stage, generates appropriate binary representations
+ * for instructions and data, and handles symbol references, without reading the file again.
+ * Every record knows where its words go, so a large file is encoded in chunks of records on several
+ * threads, and the external references of the chunks are added in record order once they are done.
+ * As in the first stage, the image limits cap a valid file to a few chunks of MIN_CHUNK_LINES records.
  */
 
 #include "secondStage.h"
 
-/* This function implements the second stage of assembly processing */
-int secondStage(struct AssemblyUnit* Unit, FILE* assembly_file, char *file_name) {
-    char line[MAX_LENGTH] = {0};
-    extern struct analized_line current_line;
+/* Function run as a task for every chunk, encodes its records into their slices of the code and data images */
+static void *encode_records(void *chunk_pointer) {
+    struct encode_chunk *chunk = chunk_pointer;
+    struct AssemblyUnit *Unit = chunk->unit;
+    struct line_record *record;
+    const struct instruction_template *template;
     struct symbols_table *current_symbol;
-    struct external_symbols_table *current_external_symbol;
-    int line_counter = 1;
+    struct external_reference *reference;
+    char *label_name;
+    uint16_t *code;
+    int operand_index;
+    int r;
     int i;
 
-    /* Validate input parameters */
-    if (Unit == NULL || assembly_file == NULL || file_name == NULL) {
-        fprintf(stderr, "Error: Null pointer passed to secondStage\n");
-        return ERROR;
-    }
+    /* Process each line record of the chunk */
+    for (r = chunk->first_record; r < chunk->end_record; r++) {
+        record = &Unit->lines.records[r];
 
-    rewind(assembly_file);
+        /* Handle code lines, the template of the opcode and operand modes gives every word but the operands' */
+        if (record->line_type == code_line) {
+            template = find_instruction_template(record->opcode, record->operand_type[0], record->operand_type[1]);
 
-    /* Process each line in the assembly file */
-    while (fgets(line, sizeof(line), assembly_file) != NULL) {
-        if (analyze_assembly_line(line) != 0) {
-            fprintf(stderr, "Error in file %s, line %d: Failed to analyze line\n", file_name, line_counter);
-            return ERROR;
-        }
+            code = Unit->code + record->word_offset;
+            code[0] = TO_WORD(template->first_word);
 
-        /* Handle code lines */
-        if (current_line.line_type == code_line) {
-            /* Check if code size limit is exceeded */
-            if (Unit->code_size >= MAX_CODE_SIZE) {
-                fprintf(stderr, "Error in file %s, line %d: Code size exceeded maximum limit\n", file_name, line_counter);
-                return ERROR;
-            }
-
-            /* Generate machine code for the instruction */
-            Unit->code[Unit->code_size] = current_line.opcode << 11;
-
-            if (current_line.operand_type[0] != none)
-                Unit->code[Unit->code_size] |= 1 << (current_line.operand_type[0] + 7);
-            if (current_line.operand_type[1] != none)
-                Unit->code[Unit->code_size] |= 1 << (current_line.operand_type[1] + 3);
-            Unit->code[Unit->code_size] |= 4;
-            Unit->code_size++;
-
-            /* Handle different operand combinations */
-            if ((current_line.operand_type[0] == direct_register || current_line.operand_type[0] == indirect_register) &&
-                (current_line.operand_type[1] == direct_register || current_line.operand_type[1] == indirect_register)) {
-                /* Handle register-to-register operations */
-                if (Unit->code_size >= MAX_CODE_SIZE) {
-                    fprintf(stderr, "Error in file %s, line %d: Code size exceeded maximum limit\n", file_name, line_counter);
-                    return ERROR;
-                }
-                Unit->code[Unit->code_size] = current_line.operand_list[0].register_num << 6;
-                Unit->code[Unit->code_size] |= current_line.operand_list[1].register_num << 3;
-                Unit->code[Unit->code_size++] |= 4;
-            } else {
-                /* Handle other operand types */
-                for (i = 0; i < 2; i++) {
-                    if (current_line.operand_type[i] == none) {
-                        /* Do nothing for empty operands */
-                    } else if (current_line.operand_type[i] == immediate) {
+            /* Generate the extra words in the order of the template's layout */
+            for (i = 1; i < template->word_count; i++) {
+                operand_index = template->extra_operand[i - 1];
+                switch (template->extra_kind[i - 1]) {
+                    case extra_register_pair:
+                        /* Handle register-to-register operations */
+                        code[i] = TO_WORD((record->operand_value[0] << 6) | (record->operand_value[1] << 3) | 4);
+                        break;
+                    case extra_register:
+                        /* Handle register operands */
+                        code[i] = TO_WORD((record->operand_value[operand_index] << (6 - (operand_index * 3))) | 4);
+                        break;
+                    case extra_immediate:
                         /* Handle immediate values */
-                        if (Unit->code_size >= MAX_CODE_SIZE) {
-                            fprintf(stderr, "Error in file %s, line %d: Code size exceeded maximum limit\n", file_name, line_counter);
-                            return ERROR;
+                        code[i] = TO_WORD((record->operand_value[operand_index] << 3) | 4);
+                        break;
+                    case extra_label:
+                        /* Handle labels and symbols, the table is complete and only read here */
+                        label_name = Unit->lines.names + record->label_offset[operand_index];
+                        chunk->symbol_lookups++;
+                        current_symbol = lookup_symbol_span(Unit, label_name, strlen(label_name), &chunk->symbol_probes);
+                        if (current_symbol == NULL) {
+                            chunk->failed_record = r;
+                            chunk->failed_label = label_name;
+                            return NULL;
                         }
-                        Unit->code[Unit->code_size++] = (current_line.operand_list[i].immediate_value << 3) | 4;
-                    } else if (current_line.operand_type[i] == label) {
-                        /* Handle labels and symbols */
-                        current_symbol = search_symbol(Unit, current_line.operand_list[i].label_name);
-                        if (current_symbol) {
-                            if (current_symbol->symbol_type == external_symbol) {
-                                /* Process external symbols */
-                                current_external_symbol = search_external_symbol(Unit, current_symbol->symbol_name);
-                                if (current_external_symbol) {
-                                    if (current_external_symbol->address_count >= MAX_EXTERNAL_ADDRESSES) {
-                                        fprintf(stderr, "Error in file %s, line %d: Too many references to external symbol '%s'\n", 
-                                                file_name, line_counter, current_symbol->symbol_name);
-                                        return ERROR;
-                                    }
-                                    current_external_symbol->external_symbol_addresses[current_external_symbol->address_count++] = Unit->code_size + INIT_ADDRESS;
-                                } else {
-                                    /* Add new external symbol */
-                                    if (Unit->externals_size >= MAX_EXTERNALS) {
-                                        fprintf(stderr, "Error in file %s, line %d: Too many external symbols\n", file_name, line_counter);
-                                        return ERROR;
-                                    }
-                                    current_external_symbol = &Unit->externals[Unit->externals_size];
-                                    current_external_symbol->external_symbol_addresses[0] = Unit->code_size + INIT_ADDRESS;
-                                    current_external_symbol->address_count = 1;
-                                    current_external_symbol->external_symbol_name = current_symbol->symbol_name;
-                                    Unit->externals_size++;
-                                }
-                                if (Unit->code_size >= MAX_CODE_SIZE) {
-                                    fprintf(stderr, "Error in file %s, line %d: Code size exceeded maximum limit\n", file_name, line_counter);
-                                    return ERROR;
-                                }
-                                Unit->code[Unit->code_size++] = 1;
-                            } else {
-                                /* Handle internal symbols */
-                                if (Unit->code_size >= MAX_CODE_SIZE) {
-                                    fprintf(stderr, "Error in file %s, line %d: Code size exceeded maximum limit\n", file_name, line_counter);
-                                    return ERROR;
-                                }
-                                Unit->code[Unit->code_size++] = ((current_symbol->symbol_address << 3) | 2);
-                            }
+                        if (current_symbol->symbol_type == external_symbol) {
+                            /* Keep the external reference, it is added to the unit in record order */
+                            chunk->references = grow_array(chunk->references, &chunk->references_capacity,
+                                                           chunk->references_count + 1, sizeof(*chunk->references));
+                            reference = &chunk->references[chunk->references_count++];
+                            reference->symbol_name = current_symbol->symbol_name;
+                            reference->address = record->word_offset + i + INIT_ADDRESS;
+                            reference->line_number = record->line_number;
+                            code[i] = 1;
                         } else {
-                            fprintf(stderr, "Error in file %s, line %d: Unrecognized symbol '%s'\n", 
-                                    file_name, line_counter, current_line.operand_list[i].label_name);
-                            return ERROR;
-                        }
-                    } else if (current_line.operand_type[i] == direct_register || current_line.operand_type[i] == indirect_register) {
-                        /* Handle register operands */
-                        if (Unit->code_size >= MAX_CODE_SIZE) {
-                            fprintf(stderr, "Error in file %s, line %d: Code size exceeded maximum limit\n", file_name, line_counter);
-                            return ERROR;
+                            /* Handle internal symbols */
+                            code[i] = TO_WORD((current_symbol->symbol_address << 3) | 2);
                         }
-                        Unit->code[Unit->code_size++] = (current_line.operand_list[i].register_num << (6 - (i * 3))) | 4;
-                    } else {
-                        fprintf(stderr, "Error in file %s, line %d: Invalid operand type\n", file_name, line_counter);
-                        return ERROR;
-                    }
-                }
-            }
-        } else if (current_line.line_type == directive_line && current_line.directive_type <= directive_data) {
-            /* Handle directive lines */
-            if (current_line.directive_type == directive_data) {
-                /* Process data directive */
-                for (i = 0; i < current_line.data_size; i++) {
-                    if (Unit->data_size >= MAX_DATA_SIZE) {
-                        fprintf(stderr, "Error in file %s, line %d: Data size exceeded maximum limit\n", file_name, line_counter);
-                        return ERROR;
-                    }
-                    Unit->data[Unit->data_size++] = current_line.data_value[i];
-                }
-            } else {
-                /* Process string directive */
-                for (i = 0; i < strlen(current_line.directive_string) + 1; i++) {
-                    if (Unit->data_size >= MAX_DATA_SIZE) {
-                        fprintf(stderr, "Error in file %s, line %d: Data size exceeded maximum limit\n", file_name, line_counter);
-                        return ERROR;
-                    }
-                    Unit->data[Unit->data_size++] = current_line.directive_string[i];
+                        break;
+                    default:
+                        chunk->failed_record = r;
+                        return NULL;
                 }
             }
+            chunk->code_words += template->word_count;
+        } else {
+            /* Handle data lines, the payload holds the .data values or the .string characters */
+            memcpy(Unit->data + record->word_offset, Unit->lines.payload + record->payload_offset,
+                   record->payload_size * sizeof(*Unit->data));
+            chunk->data_words += record->payload_size;
         }
+    }
+    return NULL;
+}
 
-        line_counter++;
+/* Function to add the external references of a chunk to the unit, returns ERROR when a table limit is exceeded */
+static int add_chunk_references(struct AssemblyUnit *Unit, const struct encode_chunk *chunk, char *file_name) {
+    const struct external_reference *reference;
+    struct external_symbols_table *current_external_symbol;
+    int i;
+
+    for (i = 0; i < chunk->references_count; i++) {
+        reference = &chunk->references[i];
+        current_external_symbol = search_external_symbol(Unit, (char *)reference->symbol_name);
+        if (current_external_symbol) {
+            if (current_external_symbol->address_count >= MAX_EXTERNAL_ADDRESSES) {
+                report(stderr, "Error in file %s, line %d: Too many references to external symbol '%s'\n", 
+                        file_name, reference->line_number, reference->symbol_name);
+                return ERROR;
+            }
+        } else {
+            /* Add new external symbol */
+            if (Unit->externals_size >= MAX_EXTERNALS) {
+                report(stderr, "Error in file %s, line %d: Too many external symbols\n", file_name, reference->line_number);
+                return ERROR;
+            }
+            current_external_symbol = add_external_symbol(Unit, (char *)reference->symbol_name);
+        }
+        add_external_address(current_external_symbol, reference->address);
     }
+    return 0;
+}
+
+/* This function implements the second stage of assembly processing, the records are encoded in up to jobs chunks */
+int secondStage(struct AssemblyUnit* Unit, char *file_name, int jobs) {
+    struct encode_chunk *chunks;
+    struct encode_chunk *chunk;
+    int chunks_count;
+    int result = 0;
+    int k;
 
-    /* Check for file read errors */
-    if (ferror(assembly_file)) {
-        fprintf(stderr, "Error: Failed to read from assembly file %s\n", file_name);
+    /* Validate input parameters */
+    if (Unit == NULL || file_name == NULL) {
+        report(stderr, "Error: Null pointer passed to secondStage\n");
         return ERROR;
     }
 
-    return 0;  /* If treated nicely, returns a success flag */
+    /* Small files are encoded on the calling thread alone */
+    chunks_count = Unit->lines.records_size / MIN_CHUNK_LINES;
+    chunks_count = chunks_count < jobs ? chunks_count : jobs;
+    chunks_count = chunks_count > 1 ? chunks_count : 1;
+
+    chunks = calloc(chunks_count, sizeof(*chunks));
+    if (chunks == NULL) {
+        fprintf(stderr, "[ERROR] Out of memory, aborting.\n");
+        exit(1);
+    }
+    for (k = 0; k < chunks_count; k++) {
+        chunks[k].unit = Unit;
+        chunks[k].first_record = (int)((long)Unit->lines.records_size * k / chunks_count);
+        chunks[k].end_record = (int)((long)Unit->lines.records_size * (k + 1) / chunks_count);
+        chunks[k].failed_record = NOT_FOUND;
+    }
+
+    /* The chunks are tasks of the worker pool, idle workers steal them */
+    run_tasks(encode_records, chunks, chunks_count, sizeof(*chunks));
+
+    /* Add the external references in record order, the first error in that order is the one reported */
+    for (k = 0; k < chunks_count && result == 0; k++) {
+        chunk = &chunks[k];
+        Unit->symbol_lookups += chunk->symbol_lookups;
+        Unit->symbol_probes += chunk->symbol_probes;
+        result = add_chunk_references(Unit, chunk, file_name);
+        if (result == 0 && chunk->failed_record != NOT_FOUND) {
+            if (chunk->failed_label != NULL) {
+                report(stderr, "Error in file %s, line %d: Unrecognized symbol '%s'\n", 
+                        file_name, Unit->lines.records[chunk->failed_record].line_number, chunk->failed_label);
+            } else {
+                report(stderr, "Error in file %s, line %d: Invalid operand type\n", 
+                        file_name, Unit->lines.records[chunk->failed_record].line_number);
+            }
+            result = ERROR;
+        }
+        Unit->code_size += chunk->code_words;
+        Unit->data_size += chunk->data_words;
+    }
+
+    for (k = 0; k < chunks_count; k++) {
+        free(chunks[k].references);
+    }
+    free(chunks);
+    return result;  /* If treated nicely, returns a success flag */
 }
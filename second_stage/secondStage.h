@@ -10,8 +10,35 @@
 /* Include necessery header files. */
 #include "../utils.h"
 #include "../line_interpreter.h"
+#include "../worker_pool.h"
+
+/* Structure representing a reference to an external symbol found while encoding */
+struct external_reference {
+    const char *symbol_name;
+    int address;
+    int line_number;
+};
+
+/* Structure representing a run of line records encoded by one thread.
+ * Its words go to the slices of the images given by the offsets of its records, while
+ * its external references are kept apart and added to the unit in record order at the end.
+ * An encoding error stops the chunk at the failed record, NOT_FOUND when there was none. */
+struct encode_chunk {
+    struct AssemblyUnit *unit;
+    int first_record;
+    int end_record;
+    int code_words;
+    int data_words;
+    struct external_reference *references;
+    int references_count;
+    int references_capacity;
+    int failed_record;
+    const char *failed_label;
+    long symbol_lookups;
+    long symbol_probes;
+};
 
 /* SecondStage function prototype. */
-int secondStage(struct AssemblyUnit* Unit, FILE* assembly_file, char *file_name );
+int secondStage(struct AssemblyUnit* Unit, char *file_name, int jobs);
 
 #endif 
@@ -0,0 +1,382 @@
+/*
+ * This file implements the statistics of the assembler, reported with --stats.
+ * The file assembled by a thread is timed and counted through a thread-specific pointer,
+ * so the passes report to it without knowing if statistics are collected at all.
+ * Finished files are recorded in a list shared by the worker threads and printed at the end of the run.
+ * Hardware counters are opened for the calling thread only, so each worker measures the file it assembles.
+ * A chunk of a file stolen by another worker is measured with the thief's own counters and credited to the file,
+ * which adds the credited counts to the phase that was running the chunk when the phase ends.
+ */
+
+/* syscall is needed for perf_event_open, which has no libc wrapper */
+#define _DEFAULT_SOURCE
+
+#include "stats.h"
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+/* Names of the phases and counters, in the order of their enumerations */
+static const char *phase_names[NUMBER_OF_PHASES] = {
+    "preprocess", "first_stage", "second_stage", "object_file", "entry_file", "external_file"
+};
+static const char *counter_names[NUMBER_OF_COUNTERS] = {
+    "lines_read", "lines_analyzed", "symbol_lookups", "symbol_probes", "macro_expansions", "bytes_written",
+    "line_cache_hits", "line_cache_misses"
+};
+static const char *hardware_names[NUMBER_OF_HARDWARE_COUNTERS] = {
+    "cycles", "instructions", "branch_misses", "cache_misses"
+};
+static const unsigned long hardware_events[NUMBER_OF_HARDWARE_COUNTERS] = {
+    PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES
+};
+
+/* Key of the statistics of the file assembled by the calling thread */
+static pthread_key_t stats_key;
+static pthread_once_t stats_key_once = PTHREAD_ONCE_INIT;
+
+/* Statistics of the files assembled so far, shared by the worker threads */
+static struct file_stats *recorded_stats = NULL;
+static int recorded_count = 0;
+static int recorded_capacity = 0;
+static pthread_mutex_t recorded_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Work of the workers of the pool, in the order of the workers */
+static struct worker_stats *recorded_workers = NULL;
+static int recorded_workers_count = 0;
+static int recorded_workers_capacity = 0;
+
+/* Function to open a hardware counter of the calling thread in user space, returns -1 when it isn't available */
+static int open_hardware_counter(unsigned long event) {
+    struct perf_event_attr attributes;
+
+    memset(&attributes, 0, sizeof(attributes));
+    attributes.type = PERF_TYPE_HARDWARE;
+    attributes.size = sizeof(attributes);
+    attributes.config = event;
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0);
+}
+
+/* Function to read the hardware counters of a file, a counter that can't be read keeps its last value */
+static void read_hardware_counters(const struct file_stats *stats, uint64_t *values) {
+    uint64_t value;
+    int i;
+
+    for (i = 0; i < NUMBER_OF_HARDWARE_COUNTERS; i++) {
+        if (stats->hardware_descriptors[i] >= 0 &&
+            read(stats->hardware_descriptors[i], &value, sizeof(value)) == (ssize_t)sizeof(value)) {
+            values[i] = value;
+        }
+    }
+}
+
+/* Function to start the statistics of a file, its hardware counters are opened for the calling thread on request */
+void init_file_stats(struct file_stats *stats, const char *filename, bool hardware_counters) {
+    int i;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->filename = filename;
+    for (i = 0; i < NUMBER_OF_HARDWARE_COUNTERS; i++) {
+        stats->hardware_descriptors[i] = hardware_counters ? open_hardware_counter(hardware_events[i]) : -1;
+        stats->hardware_available[i] = stats->hardware_descriptors[i] >= 0;
+    }
+}
+
+/* Function to close the hardware counters of a file */
+void close_file_stats(struct file_stats *stats) {
+    int i;
+
+    for (i = 0; i < NUMBER_OF_HARDWARE_COUNTERS; i++) {
+        if (stats->hardware_descriptors[i] >= 0) {
+            close(stats->hardware_descriptors[i]);
+            stats->hardware_descriptors[i] = -1;
+        }
+    }
+}
+
+/* Function to create the thread-specific statistics key, runs once */
+static void create_stats_key(void) {
+    pthread_key_create(&stats_key, NULL);
+}
+
+/* Function to route the statistics of the calling thread to a structure, NULL collects nothing */
+void set_thread_stats(struct file_stats *stats) {
+    pthread_once(&stats_key_once, create_stats_key);
+    pthread_setspecific(stats_key, stats);
+}
+
+/* Function to get the statistics of the calling thread, NULL when nothing is collected */
+struct file_stats *get_thread_stats(void) {
+    pthread_once(&stats_key_once, create_stats_key);
+    return pthread_getspecific(stats_key);
+}
+
+/* Function to read the monotonic wall clock in seconds */
+double stats_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/* Function to mark the start of a phase of the file of the calling thread */
+void start_phase(struct phase_mark *mark) {
+    struct file_stats *stats = get_thread_stats();
+
+    int i;
+
+    if (stats != NULL) {
+        memset(mark->hardware, 0, sizeof(mark->hardware));
+        read_hardware_counters(stats, mark->hardware);
+        for (i = 0; i < NUMBER_OF_HARDWARE_COUNTERS; i++) {
+            mark->credited[i] = __atomic_load_n(&stats->credited_hardware[i], __ATOMIC_RELAXED);
+        }
+        mark->start = stats_clock();
+    }
+}
+
+/* Function to add the time and the hardware counts since the start of a phase to the file of the calling thread */
+void end_phase(stat_phase phase, const struct phase_mark *mark) {
+    struct file_stats *stats = get_thread_stats();
+    uint64_t values[NUMBER_OF_HARDWARE_COUNTERS];
+    int i;
+
+    if (stats != NULL) {
+        stats->phase_seconds[phase] += stats_clock() - mark->start;
+        memcpy(values, mark->hardware, sizeof(values));
+        read_hardware_counters(stats, values);
+        for (i = 0; i < NUMBER_OF_HARDWARE_COUNTERS; i++) {
+            stats->hardware[phase][i] += values[i] - mark->hardware[i];
+            stats->hardware[phase][i] += __atomic_load_n(&stats->credited_hardware[i], __ATOMIC_RELAXED) - mark->credited[i];
+        }
+    }
+}
+
+/* Function to mark the start of a chunk task of another thread's file, measured with the given counters of the calling thread */
+void start_task_counts(const struct file_stats *counters, struct phase_mark *mark) {
+    memset(mark->hardware, 0, sizeof(mark->hardware));
+    read_hardware_counters(counters, mark->hardware);
+}
+
+/* Function to credit the hardware counts since the start of a chunk task to the file it belongs to.
+ * The task is done before the phase of the file that queued it ends, so the counts land in that phase */
+void credit_task_counts(const struct file_stats *counters, const struct phase_mark *mark, struct file_stats *stats) {
+    uint64_t values[NUMBER_OF_HARDWARE_COUNTERS];
+    int i;
+
+    memcpy(values, mark->hardware, sizeof(values));
+    read_hardware_counters(counters, values);
+    for (i = 0; i < NUMBER_OF_HARDWARE_COUNTERS; i++) {
+        __atomic_fetch_add(&stats->credited_hardware[i], values[i] - mark->hardware[i], __ATOMIC_RELAXED);
+    }
+}
+
+/* Function to add an amount to a counter of the file of the calling thread */
+void add_stat(stat_counter counter, long amount) {
+    struct file_stats *stats = get_thread_stats();
+    if (stats != NULL) {
+        stats->counters[counter] += amount;
+    }
+}
+
+/* Function to record the statistics of a finished file for the report of the run */
+void record_file_stats(const struct file_stats *stats) {
+    pthread_mutex_lock(&recorded_lock);
+    recorded_stats = grow_array(recorded_stats, &recorded_capacity, recorded_count + 1, sizeof(*recorded_stats));
+    recorded_stats[recorded_count++] = *stats;
+    pthread_mutex_unlock(&recorded_lock);
+}
+
+/* Function to record the work of a worker of the pool for the report of the run */
+void record_worker_stats(const struct worker_stats *stats) {
+    pthread_mutex_lock(&recorded_lock);
+    recorded_workers = grow_array(recorded_workers, &recorded_workers_capacity, recorded_workers_count + 1, sizeof(*recorded_workers));
+    recorded_workers[recorded_workers_count++] = *stats;
+    pthread_mutex_unlock(&recorded_lock);
+}
+
+/* Function to print a file name as a JSON string */
+static void print_json_string(FILE *out, const char *text) {
+    fputc(DOUBLE_QUOTE, out);
+    for (; *text != '\0'; text++) {
+        if (*text == DOUBLE_QUOTE || *text == '\\') {
+            fputc('\\', out);
+            fputc(*text, out);
+        } else if ((unsigned char)*text < ' ') {
+            fprintf(out, "\\u%04x", (unsigned char)*text);
+        } else {
+            fputc(*text, out);
+        }
+    }
+    fputc(DOUBLE_QUOTE, out);
+}
+
+/* Function to print the hardware counts of every phase of a file, a counter that isn't available is printed as n/a or null */
+static void print_hardware_counts(FILE *out, const struct file_stats *stats, stats_format format) {
+    int i;
+    int j;
+
+    if (format == stats_json) {
+        fprintf(out, ", \"hardware\": {");
+        for (i = 0; i < NUMBER_OF_PHASES; i++) {
+            fprintf(out, "%s\"%s\": {", i > 0 ? ", " : "", phase_names[i]);
+            for (j = 0; j < NUMBER_OF_HARDWARE_COUNTERS; j++) {
+                fprintf(out, "%s\"%s\": ", j > 0 ? ", " : "", hardware_names[j]);
+                if (stats->hardware_available[j]) {
+                    fprintf(out, "%lu", (unsigned long)stats->hardware[i][j]);
+                } else {
+                    fprintf(out, "null");
+                }
+            }
+            fprintf(out, "}");
+        }
+        fprintf(out, "}");
+        return;
+    }
+
+    fprintf(out, "  %-18s", "hardware");
+    for (j = 0; j < NUMBER_OF_HARDWARE_COUNTERS; j++) {
+        fprintf(out, " %14s", hardware_names[j]);
+    }
+    fprintf(out, "\n");
+    for (i = 0; i < NUMBER_OF_PHASES; i++) {
+        fprintf(out, "  %-18s", phase_names[i]);
+        for (j = 0; j < NUMBER_OF_HARDWARE_COUNTERS; j++) {
+            if (stats->hardware_available[j]) {
+                fprintf(out, " %14lu", (unsigned long)stats->hardware[i][j]);
+            } else {
+                fprintf(out, " %14s", "n/a");
+            }
+        }
+        fprintf(out, "\n");
+    }
+}
+
+/* Function to compute the share of the lines whose analysis was reused */
+static double line_cache_hit_rate(const struct file_stats *stats) {
+    long lookups = stats->counters[counter_line_cache_hits] + stats->counters[counter_line_cache_misses];
+    return lookups > 0 ? (double)stats->counters[counter_line_cache_hits] / lookups : 0.0;
+}
+
+/* Function to print the statistics of a file or of the whole run */
+static void print_file_stats(FILE *out, const char *title, const struct file_stats *stats, stats_format format, bool hardware_counters) {
+    int i;
+
+    if (format == stats_json) {
+        fprintf(out, "{\"file\": ");
+        if (title == NULL) {
+            fprintf(out, "null");
+        } else {
+            print_json_string(out, title);
+        }
+        fprintf(out, ", \"seconds\": {");
+        for (i = 0; i < NUMBER_OF_PHASES; i++) {
+            fprintf(out, "%s\"%s\": %.6f", i > 0 ? ", " : "", phase_names[i], stats->phase_seconds[i]);
+        }
+        fprintf(out, "}, \"counters\": {");
+        for (i = 0; i < NUMBER_OF_COUNTERS; i++) {
+            fprintf(out, "%s\"%s\": %ld", i > 0 ? ", " : "", counter_names[i], stats->counters[i]);
+        }
+        fprintf(out, "}, \"line_cache_hit_rate\": %.4f", line_cache_hit_rate(stats));
+        if (hardware_counters) {
+            print_hardware_counts(out, stats, format);
+        }
+        fprintf(out, "}");
+        return;
+    }
+
+    fprintf(out, "Statistics for %s:\n", title == NULL ? "all files" : title);
+    for (i = 0; i < NUMBER_OF_PHASES; i++) {
+        fprintf(out, "  %-18s %12.6f s\n", phase_names[i], stats->phase_seconds[i]);
+    }
+    for (i = 0; i < NUMBER_OF_COUNTERS; i++) {
+        fprintf(out, "  %-18s %12ld\n", counter_names[i], stats->counters[i]);
+    }
+    fprintf(out, "  %-18s %12.1f %%\n", "line_cache_hit_rate", 100 * line_cache_hit_rate(stats));
+    if (hardware_counters) {
+        print_hardware_counts(out, stats, format);
+    }
+}
+
+/* Function to print the utilization of every worker of the pool, the share of the run it wasn't waiting for work */
+static void print_worker_stats(FILE *out, stats_format format) {
+    const struct worker_stats *stats;
+    double utilization;
+    int i;
+
+    if (format != stats_json && recorded_workers_count > 0) {
+        fprintf(out, "Workers:\n");
+    }
+    for (i = 0; i < recorded_workers_count; i++) {
+        stats = &recorded_workers[i];
+        utilization = stats->seconds > 0 ? stats->busy_seconds / stats->seconds : 0.0;
+        if (format == stats_json) {
+            fprintf(out, "%s\n  {\"worker\": %d, \"seconds\": %.6f, \"busy_seconds\": %.6f, \"utilization\": %.4f, "
+                   "\"files\": %d, \"tasks\": %ld, \"stolen\": %ld}",
+                   i > 0 ? "," : "", i, stats->seconds, stats->busy_seconds, utilization, stats->files, stats->tasks, stats->stolen);
+        } else {
+            fprintf(out, "  worker %-11d %12.1f %%  files %d, tasks %ld, stolen %ld\n",
+                   i, 100 * utilization, stats->files, stats->tasks, stats->stolen);
+        }
+    }
+}
+
+/* Function to print the statistics of every file in command line order, then their totals and the workers, to the given stream */
+void print_stats(FILE *out, char **filenames, int files_count, stats_format format, bool hardware_counters) {
+    struct file_stats total = {0};
+    int printed = 0;
+    int i;
+    int j;
+    int k;
+    int m;
+
+    /* A hardware counter of the totals is available only when every file measured it */
+    for (k = 0; k < NUMBER_OF_HARDWARE_COUNTERS; k++) {
+        total.hardware_available[k] = true;
+    }
+
+    pthread_mutex_lock(&recorded_lock);
+    if (format == stats_json) {
+        fprintf(out, "{\"files\": [");
+    }
+
+    /* Files are matched by the argument they were given as, so a file named twice is reported twice */
+    for (i = 0; i < files_count; i++) {
+        for (j = 0; j < recorded_count && recorded_stats[j].filename != filenames[i]; j++);
+        if (j == recorded_count) {
+            continue;
+        }
+        if (format == stats_json) {
+            fprintf(out, "%s\n  ", printed > 0 ? "," : "");
+        }
+        print_file_stats(out, filenames[i], &recorded_stats[j], format, hardware_counters);
+        printed++;
+        for (k = 0; k < NUMBER_OF_PHASES; k++) {
+            total.phase_seconds[k] += recorded_stats[j].phase_seconds[k];
+            for (m = 0; m < NUMBER_OF_HARDWARE_COUNTERS; m++) {
+                total.hardware[k][m] += recorded_stats[j].hardware[k][m];
+            }
+        }
+        for (k = 0; k < NUMBER_OF_COUNTERS; k++) {
+            total.counters[k] += recorded_stats[j].counters[k];
+        }
+        for (k = 0; k < NUMBER_OF_HARDWARE_COUNTERS; k++) {
+            total.hardware_available[k] = total.hardware_available[k] && recorded_stats[j].hardware_available[k];
+        }
+    }
+
+    if (format == stats_json) {
+        fprintf(out, "],\n \"total\": ");
+        print_file_stats(out, NULL, &total, format, hardware_counters);
+        fprintf(out, ",\n \"workers\": [");
+        print_worker_stats(out, format);
+        fprintf(out, "]}\n");
+    } else {
+        print_file_stats(out, NULL, &total, format, hardware_counters);
+        print_worker_stats(out, format);
+    }
+    pthread_mutex_unlock(&recorded_lock);
+    fflush(out);
+}
@@ -0,0 +1,106 @@
+/*
+ * This header file declares the statistics of the assembler, reported with --stats.
+ * Each file gets the wall time of every phase of its assembly and a set of counters,
+ * collected through a per-thread pointer like the diagnostics, and the run reports them
+ * per file and in aggregate, as text or as JSON.
+ * With --perf-counters every phase is also measured with the hardware counters of perf_event_open,
+ * a counter the kernel or the machine doesn't provide is reported as unavailable.
+ * When the files are assembled by the worker pool, the utilization of every worker follows.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+/* Included necessary header file */
+#include "utils.h"
+
+#define STATS_FLAG "--stats"
+#define STATS_JSON_FLAG "--stats=json"
+#define STATS_JSON_PATH_FLAG "--stats=json:"
+#define PERF_COUNTERS_FLAG "--perf-counters"
+
+/* Enumeration for the output formats of the statistics */
+typedef enum stats_format {
+    stats_off,
+    stats_text,
+    stats_json
+} stats_format;
+
+/* Enumeration for the timed phases of the assembly of a file */
+typedef enum stat_phase {
+    phase_preprocess,
+    phase_first_stage,
+    phase_second_stage,
+    phase_object_file,
+    phase_entry_file,
+    phase_external_file,
+    NUMBER_OF_PHASES
+} stat_phase;
+
+/* Enumeration for the counters of the assembly of a file */
+typedef enum stat_counter {
+    counter_lines_read,
+    counter_lines_analyzed,
+    counter_symbol_lookups,
+    counter_symbol_probes,
+    counter_macro_expansions,
+    counter_bytes_written,
+    counter_line_cache_hits,
+    counter_line_cache_misses,
+    NUMBER_OF_COUNTERS
+} stat_counter;
+
+/* Enumeration for the hardware counters measured around each phase */
+typedef enum hardware_counter {
+    hardware_cycles,
+    hardware_instructions,
+    hardware_branch_misses,
+    hardware_cache_misses,
+    NUMBER_OF_HARDWARE_COUNTERS
+} hardware_counter;
+
+/* Structure holding the statistics of the assembly of one file.
+ * A hardware counter descriptor is -1 when the counter isn't measured.
+ * credited_hardware sums the counts of the chunks of the file run by other threads, added atomically */
+struct file_stats {
+    const char *filename;
+    double phase_seconds[NUMBER_OF_PHASES];
+    long counters[NUMBER_OF_COUNTERS];
+    int hardware_descriptors[NUMBER_OF_HARDWARE_COUNTERS];
+    bool hardware_available[NUMBER_OF_HARDWARE_COUNTERS];
+    uint64_t hardware[NUMBER_OF_PHASES][NUMBER_OF_HARDWARE_COUNTERS];
+    uint64_t credited_hardware[NUMBER_OF_HARDWARE_COUNTERS];
+};
+
+/* Structure holding the clock and the hardware counters at the start of a phase or of a chunk task */
+struct phase_mark {
+    double start;
+    uint64_t hardware[NUMBER_OF_HARDWARE_COUNTERS];
+    uint64_t credited[NUMBER_OF_HARDWARE_COUNTERS];
+};
+
+/* Structure holding the work of a worker thread of the pool, over the whole run of the pool */
+struct worker_stats {
+    double seconds;
+    double busy_seconds;
+    int files;
+    long tasks;
+    long stolen;
+};
+
+/* Function declarations */
+void init_file_stats(struct file_stats *stats, const char *filename, bool hardware_counters);
+void close_file_stats(struct file_stats *stats);
+void set_thread_stats(struct file_stats *stats);
+struct file_stats *get_thread_stats(void);
+void start_phase(struct phase_mark *mark);
+void end_phase(stat_phase phase, const struct phase_mark *mark);
+void add_stat(stat_counter counter, long amount);
+void start_task_counts(const struct file_stats *counters, struct phase_mark *mark);
+void credit_task_counts(const struct file_stats *counters, const struct phase_mark *mark, struct file_stats *stats);
+void record_file_stats(const struct file_stats *stats);
+void record_worker_stats(const struct worker_stats *stats);
+double stats_clock(void);
+void print_stats(FILE *out, char **filenames, int files_count, stats_format format, bool hardware_counters);
+
+#endif
@@ -5,106 +5,545 @@
  */
 
 #include "utils.h"
+#include "build_cache.h"
+#include "stats.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
-/* Global structures for processing data */
-static struct AssemblyUnit AssemblyUnit = {0};
-extern struct analized_line current_line;
+static int build_file(char *filename, const struct assembler_options *options);
+static int assemble_file(char *filename, const struct assembler_options *options, int *outputs);
 
-/* Function to process a single assembly file */
-int process_file(char *filename) {
-    FILE *input_file = NULL;
-    char *preprocessed_filename = NULL;
-    int result = 0;
+/* Function to process a single assembly file, its statistics are recorded when --stats is given */
+int process_file(char *filename, const struct assembler_options *options) {
+    struct file_stats stats;
+    int result;
 
     if (filename == NULL) {
-        fprintf(stderr, "Error: Null filename provided\n");
+        report(stderr, "Error: Null filename provided\n");
         return ERROR;
     }
 
-    preprocessed_filename = preProcessor(filename);
-    if (preprocessed_filename == NULL) {
-        fprintf(stderr, "Error: Failed to preprocess file %s\n", filename);
-        return ERROR;
+    if (options->stats == stats_off) {
+        return build_file(filename, options);
+    }
+    init_file_stats(&stats, filename, options->hardware_counters);
+    set_thread_stats(&stats);
+    result = build_file(filename, options);
+    set_thread_stats(NULL);
+    close_file_stats(&stats);
+    record_file_stats(&stats);
+    return result;
+}
+
+/* Function to build a single assembly file, through the build cache when a cache directory is set */
+static int build_file(char *filename, const struct assembler_options *options) {
+    struct cache_source source;
+    struct diagnostics captured = {0};
+    struct diagnostics *outer;
+    int outputs = 0;
+    int result;
+    int i;
+
+    if (options->cache_dir == NULL || open_cache_source(options, filename, &source) != 0) {
+        return assemble_file(filename, options, &outputs);
+    }
+
+    /* On a hit the outputs and diagnostics are restored and all the passes are skipped */
+    if (restore_cache_entry(&source, options, filename, &result)) {
+        close_cache_source(&source);
+        return result;
     }
 
-    input_file = fopen(preprocessed_filename, "r");
-    if (input_file == NULL) {
-        fprintf(stderr, "Error: Unable to open file %s\n", preprocessed_filename);
-        free(preprocessed_filename);
+    /* On a miss the diagnostics are captured, so they can be stored with the outputs before they are reported */
+    outer = get_thread_diagnostics();
+    set_thread_diagnostics(&captured);
+    result = assemble_file(filename, options, &outputs);
+    set_thread_diagnostics(outer);
+
+    /* Failures to read or write files don't depend on the source, so they are not cached */
+    if (!(outputs & OUTPUT_INCOMPLETE)) {
+        store_cache_entry(&source, options, filename, outputs, &captured, result);
+    }
+    for (i = 0; i < captured.segments_count; i++) {
+        report_text(captured.segments[i].stream, captured.text + captured.segments[i].offset, captured.segments[i].length);
+    }
+
+    free_diagnostics(&captured);
+    close_cache_source(&source);
+    return result;
+}
+
+/* Function to assemble a single file through all the passes, the outputs it writes are flagged in outputs */
+static int assemble_file(char *filename, const struct assembler_options *options, int *outputs) {
+    struct source_buffer expanded = {0};
+    char *preprocessed_filename = NULL;
+    struct AssemblyUnit AssemblyUnit;
+    struct phase_mark mark;
+    int result = 0;
+
+    /* The expanded source stays in memory, the .am file is only written on request */
+    start_phase(&mark);
+    preprocessed_filename = preProcessor(filename, &expanded, options->write_am);
+    end_phase(phase_preprocess, &mark);
+    if (preprocessed_filename == NULL) {
+        report(stderr, "Error: Failed to preprocess file %s\n", filename);
+        free_source_buffer(&expanded);
+        *outputs |= OUTPUT_INCOMPLETE;
         return ERROR;
     }
+    if (options->write_am) {
+        *outputs |= OUTPUT_AM;
+    }
 
-    /* Reset the global structure before processing */
-    memset(&AssemblyUnit, 0, sizeof(AssemblyUnit));
+    /* Start from an empty unit, its tables grow with the program */
+    init_assembly_unit(&AssemblyUnit);
 
-    /* Run first and second stages processing */
-    if (firstStage(&AssemblyUnit, input_file, preprocessed_filename) != 0) {
-        fprintf(stderr, "Error: First stage processing failed for %s\n", filename);
-        result = ERROR;
-    } else if (secondStage(&AssemblyUnit, input_file, filename) != 0) {
-        fprintf(stderr, "Error: Second stage processing failed for %s\n", filename);
+    /* Run first and second stages processing, each timed on its own */
+    start_phase(&mark);
+    result = firstStage(&AssemblyUnit, &expanded, preprocessed_filename, options->jobs);
+    end_phase(phase_first_stage, &mark);
+    add_stat(counter_lines_analyzed, expanded.lines_count);
+    if (result != 0) {
+        report(stderr, "Error: First stage processing failed for %s\n", filename);
         result = ERROR;
     } else {
+        start_phase(&mark);
+        result = secondStage(&AssemblyUnit, filename, options->jobs);
+        end_phase(phase_second_stage, &mark);
+        if (result != 0) {
+            report(stderr, "Error: Second stage processing failed for %s\n", filename);
+            result = ERROR;
+        }
+    }
+
+    if (result == 0) {
         /* Create output files based on assembly results */
         if (AssemblyUnit.code_size > 0 || AssemblyUnit.data_size > 0) {
-            if (create_object_file(AssemblyUnit.code, AssemblyUnit.code_size, AssemblyUnit.data, AssemblyUnit.data_size, filename) != 0) {
-                fprintf(stderr, "Error: Failed to create object file for %s\n", filename);
+            *outputs |= OUTPUT_OBJECT;
+            start_phase(&mark);
+            if (options->binary_object) {
+                /* The binary object replaces the textual .ob when requested */
+                if (create_binary_object_file(&AssemblyUnit, filename) != 0) {
+                    report(stderr, "Error: Failed to create object file for %s\n", filename);
+                    *outputs |= OUTPUT_INCOMPLETE;
+                    result = ERROR;
+                }
+            } else if (create_object_file(AssemblyUnit.code, AssemblyUnit.code_size, AssemblyUnit.data, AssemblyUnit.data_size, filename) != 0) {
+                report(stderr, "Error: Failed to create object file for %s\n", filename);
+                *outputs |= OUTPUT_INCOMPLETE;
                 result = ERROR;
             }
+            end_phase(phase_object_file, &mark);
         }
 
         if (result == 0 && AssemblyUnit.entries_count > 0) {
+            *outputs |= OUTPUT_ENTRIES;
+            start_phase(&mark);
             if (create_entry_file(AssemblyUnit.entries, AssemblyUnit.entries_count, filename) != 0) {
-                fprintf(stderr, "Error: Failed to create entry file for %s\n", filename);
+                report(stderr, "Error: Failed to create entry file for %s\n", filename);
+                *outputs |= OUTPUT_INCOMPLETE;
                 result = ERROR;
             }
+            end_phase(phase_entry_file, &mark);
         }
 
         if (result == 0 && AssemblyUnit.externals_size > 0) {
+            *outputs |= OUTPUT_EXTERNALS;
+            start_phase(&mark);
             if (create_external_file(AssemblyUnit.externals, AssemblyUnit.externals_size, filename) != 0) {
-                fprintf(stderr, "Error: Failed to create external file for %s\n", filename);
+                report(stderr, "Error: Failed to create external file for %s\n", filename);
+                *outputs |= OUTPUT_INCOMPLETE;
                 result = ERROR;
             }
+            end_phase(phase_external_file, &mark);
         }
     }
 
-    fclose(input_file);
+    add_stat(counter_symbol_lookups, AssemblyUnit.symbol_lookups);
+    add_stat(counter_symbol_probes, AssemblyUnit.symbol_probes);
+    free_source_buffer(&expanded);
     free(preprocessed_filename);
+    free_assembly_unit(&AssemblyUnit);
 
     return result;
 }
 
+/* Assembly unit storage functions */
+
+/* Function to initialize an empty assembly unit */
+void init_assembly_unit(struct AssemblyUnit *unit) {
+    memset(unit, 0, sizeof(*unit));
+    init_symbol_table(&unit->symbols);
+}
+
+/* Function to release all the buffers owned by an assembly unit */
+void free_assembly_unit(struct AssemblyUnit *unit) {
+    int i;
+    for (i = 0; i < unit->externals_size; i++) {
+        free(unit->externals[i].external_symbol_addresses);
+    }
+    free(unit->externals);
+    free(unit->lines.payload);
+    free(unit->lines.names);
+    free(unit->lines.records);
+    free(unit->entries);
+    free_symbol_table(&unit->symbols);
+    free(unit->data);
+    free(unit->code);
+    init_assembly_unit(unit);
+}
+
+/* Function to allocate the code and data images with the sizes counted by the first stage */
+void reserve_unit_images(struct AssemblyUnit *unit, int code_words, int data_words) {
+    unit->code = grow_array(unit->code, &unit->code_capacity, code_words, sizeof(*unit->code));
+    unit->data = grow_array(unit->data, &unit->data_capacity, data_words, sizeof(*unit->data));
+}
+
+/* Function to grow a dynamic array so it holds at least 'required' elements.
+ * The capacity doubles on each growth, the first allocation is exactly 'required'. */
+void *grow_array(void *array, int *capacity, int required, size_t element_size) {
+    int new_capacity;
+    void *resized;
+
+    if (required <= *capacity) {
+        return array;
+    }
+
+    new_capacity = *capacity * 2;
+    if (new_capacity < required) {
+        new_capacity = required;
+    }
+
+    resized = realloc(array, new_capacity * element_size);
+    if (resized == NULL) {
+        fprintf(stderr, "[ERROR] Out of memory, aborting.\n");
+        exit(1);
+    }
+    *capacity = new_capacity;
+    return resized;
+}
+
+/* Source buffer functions */
+
+/* Function to append text to an in-memory source buffer */
+void append_source_text(struct source_buffer *source, const char *text, int length) {
+    source->text = grow_array(source->text, &source->text_capacity, source->text_size + length + 1, sizeof(*source->text));
+    memcpy(source->text + source->text_size, text, length);
+    source->text_size += length;
+    source->text[source->text_size] = '\0';
+}
+
+/* Function to index the start of every line of a source buffer.
+ * Lines longer than max_line_length are split the same way fgets splits them. */
+void index_source_lines(struct source_buffer *source, int max_line_length) {
+    int position = 0;
+    int line_start;
+
+    source->lines_count = 0;
+    while (position < source->text_size) {
+        line_start = position;
+        while (position < source->text_size && position - line_start < max_line_length) {
+            if (source->text[position++] == '\n') {
+                break;
+            }
+        }
+        source->line_offsets = grow_array(source->line_offsets, &source->lines_capacity, source->lines_count + 1, sizeof(*source->line_offsets));
+        source->line_offsets[source->lines_count++] = line_start;
+    }
+
+    /* Final entry marks the end of the last line */
+    source->line_offsets = grow_array(source->line_offsets, &source->lines_capacity, source->lines_count + 1, sizeof(*source->line_offsets));
+    source->line_offsets[source->lines_count] = source->text_size;
+}
+
+/* Function to release the memory of a source buffer */
+void free_source_buffer(struct source_buffer *source) {
+    free(source->text);
+    free(source->line_offsets);
+    memset(source, 0, sizeof(*source));
+}
+
+/* Function to map a source file into memory and index its lines, returns ERROR when it can't be read.
+ * The file is read front to back once, so the kernel is told to read ahead and drop the pages behind */
+int map_source_file(const char *path, struct mapped_source *source) {
+    struct stat status;
+    const char *position;
+    const char *newline;
+    const char *end;
+    void *mapping;
+    int descriptor;
+
+    memset(source, 0, sizeof(*source));
+    descriptor = open(path, O_RDONLY);
+    if (descriptor < 0) {
+        return ERROR;
+    }
+    if (fstat(descriptor, &status) != 0 || !S_ISREG(status.st_mode) || status.st_size > INT_MAX) {
+        close(descriptor);
+        return ERROR;
+    }
+
+    /* An empty file has nothing to map */
+    source->size = (int)status.st_size;
+    if (source->size > 0) {
+        mapping = mmap(NULL, source->size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+        if (mapping == MAP_FAILED) {
+            close(descriptor);
+            source->size = 0;
+            return ERROR;
+        }
+        posix_madvise(mapping, source->size, POSIX_MADV_SEQUENTIAL);
+        source->text = mapping;
+    }
+    close(descriptor);
+
+    /* Every line starts after the newline of the one before it, the last line may have none */
+    position = source->text;
+    end = source->text + source->size;
+    while (position < end) {
+        source->line_offsets = grow_array(source->line_offsets, &source->lines_capacity, source->lines_count + 1, sizeof(*source->line_offsets));
+        source->line_offsets[source->lines_count++] = position - source->text;
+        newline = memchr(position, '\n', end - position);
+        position = newline != NULL ? newline + 1 : end;
+    }
+
+    /* Final entry marks the end of the last line */
+    source->line_offsets = grow_array(source->line_offsets, &source->lines_capacity, source->lines_count + 1, sizeof(*source->line_offsets));
+    source->line_offsets[source->lines_count] = source->size;
+    return 0;
+}
+
+/* Function to unmap a source file and release its line index */
+void unmap_source_file(struct mapped_source *source) {
+    if (source->size > 0) {
+        munmap((void *)source->text, source->size);
+    }
+    free(source->line_offsets);
+    memset(source, 0, sizeof(*source));
+}
+
+/* Line records management functions */
+
+/* Function to append an empty line record for the given source line */
+struct line_record *add_line_record(struct AssemblyUnit *unit, int line_number) {
+    struct line_records_table *lines = &unit->lines;
+    struct line_record *record;
+    lines->records = grow_array(lines->records, &lines->records_capacity, lines->records_size + 1, sizeof(*lines->records));
+    record = &lines->records[lines->records_size++];
+    memset(record, 0, sizeof(*record));
+    record->line_number = line_number;
+    return record;
+}
+
+/* Function to copy a label name into the names pool, returns its offset in the pool */
+int add_line_name(struct line_records_table *lines, const char *name, int length) {
+    int offset = lines->names_size;
+    lines->names = grow_array(lines->names, &lines->names_capacity, lines->names_size + length + 1, sizeof(*lines->names));
+    memcpy(lines->names + offset, name, length);
+    lines->names[offset + length] = '\0';
+    lines->names_size += length + 1;
+    return offset;
+}
+
+/* Function to copy payload words into the payload pool, returns their offset in the pool */
+int add_line_payload(struct line_records_table *lines, const uint16_t *values, int count) {
+    int offset = lines->payload_size;
+    lines->payload = grow_array(lines->payload, &lines->payload_capacity, lines->payload_size + count, sizeof(*lines->payload));
+    memcpy(lines->payload + offset, values, count * sizeof(*values));
+    lines->payload_size += count;
+    return offset;
+}
+
 /* Symbol table management functions */
 
-/* Function to add a symbol to the symbol table */
-void add_symbol(struct AssemblyUnit *unit, char *symbol_name, enum Symbol type, 
-                int address, int line_number, int const_value, int data_size) {
-    struct symbols_table *current_symbol = &unit->symbols[unit->symbols_size];
-    strcpy(current_symbol->symbol_name, symbol_name);
-    current_symbol->symbol_type = type;
-    current_symbol->symbol_address = address;
-    current_symbol->line_number = line_number;
-    current_symbol->constant_value = const_value;
-    current_symbol->data_size = data_size;
-    unit->symbols_size++;
+/* Function to hash a symbol name (FNV-1a) */
+unsigned long hash_name(const char *name, int length) {
+    return hash_bytes(HASH_SEED, name, length);
 }
 
-/* Function to update an existing symbol in the symbol table */
-void update_symbol(struct symbols_table *symbol, int line_counter, int address, enum Symbol type) {
-    symbol->line_number = line_counter;
-    symbol->symbol_address = address;
-    symbol->symbol_type = type;
+/* Function to continue an FNV-1a hash over more bytes, starting from HASH_SEED */
+unsigned long hash_bytes(unsigned long hash, const char *bytes, long length) {
+    while (length-- > 0) {
+        hash ^= (unsigned char)*bytes++;
+        hash = (hash * 16777619UL) & 0xFFFFFFFFUL;
+    }
+    return hash;
 }
 
-/* Function to update a symbol as an entry symbol */
-void update_entry_symbol(struct symbols_table *symbol, const char *file_name, int line_counter) {
-    if (symbol->symbol_type == Symbol_code) {
-        symbol->symbol_type = entry_symbol_code;
-    } else if (symbol->symbol_type == Symbol_data) {
-        symbol->symbol_type = entry_symbol_data;
-    } else { 
-        printf("%s:%d: Symbol already exists: '%s'\n", file_name, line_counter, symbol->symbol_name); 
+/* Function to initialize an empty symbol table */
+void init_symbol_table(struct symbol_table *table) {
+    int i;
+
+    memset(table, 0, sizeof(*table));
+    for (i = 0; i < SYMBOL_STRIPES; i++) {
+        pthread_mutex_init(&table->stripes[i].lock, NULL);
+    }
+    pthread_mutex_init(&table->storage_lock, NULL);
+}
+
+/* Function to release the symbols of a table and every slots array of its stripes */
+void free_symbol_table(struct symbol_table *table) {
+    struct symbol_slots *slots;
+    struct symbol_slots *retired;
+    int i;
+
+    for (i = 0; i < SYMBOL_STRIPES; i++) {
+        for (slots = table->stripes[i].slots; slots != NULL; slots = retired) {
+            retired = slots->retired;
+            free(slots->slots);
+            free(slots);
+        }
+        pthread_mutex_destroy(&table->stripes[i].lock);
+    }
+    for (i = 0; i < table->blocks_count; i++) {
+        free(table->blocks[i]);
     }
+    free(table->blocks);
+    pthread_mutex_destroy(&table->storage_lock);
+}
+
+/* Function to get a symbol of the table by the order it was added in */
+struct symbols_table *symbol_at(const struct symbol_table *table, int index) {
+    return &table->blocks[index / SYMBOL_BLOCK_SIZE][index % SYMBOL_BLOCK_SIZE];
+}
+
+/* Function to take the storage of the next symbol of the table, a new block is allocated when the last one is full */
+static struct symbols_table *new_symbol(struct symbol_table *table) {
+    struct symbols_table *symbol;
+
+    pthread_mutex_lock(&table->storage_lock);
+    if (table->size == table->blocks_count * SYMBOL_BLOCK_SIZE) {
+        table->blocks = grow_array(table->blocks, &table->blocks_capacity, table->blocks_count + 1, sizeof(*table->blocks));
+        table->blocks[table->blocks_count] = malloc(SYMBOL_BLOCK_SIZE * sizeof(**table->blocks));
+        if (table->blocks[table->blocks_count] == NULL) {
+            fprintf(stderr, "[ERROR] Out of memory, aborting.\n");
+            exit(1);
+        }
+        table->blocks_count++;
+    }
+    symbol = symbol_at(table, table->size++);
+    pthread_mutex_unlock(&table->storage_lock);
+    return symbol;
+}
+
+/* Function to allocate the empty slots of a stripe with a power of two capacity */
+static struct symbol_slots *new_symbol_slots(int capacity) {
+    struct symbol_slots *slots = malloc(sizeof(*slots));
+
+    if (slots == NULL || (slots->slots = calloc(capacity, sizeof(*slots->slots))) == NULL) {
+        fprintf(stderr, "[ERROR] Out of memory, aborting.\n");
+        exit(1);
+    }
+    slots->capacity = capacity;
+    slots->retired = NULL;
+    return slots;
+}
+
+/* Function to publish a symbol in the first free slot of its probe sequence.
+ * The release store makes the whole symbol visible to the lookups that find it */
+static void publish_symbol(struct symbol_slots *slots, struct symbols_table *symbol) {
+    unsigned long slot = (symbol->name_hash / SYMBOL_STRIPES) & (slots->capacity - 1);
+
+    while (slots->slots[slot] != NULL) {
+        slot = (slot + 1) & (slots->capacity - 1);
+    }
+    __atomic_store_n(&slots->slots[slot], symbol, __ATOMIC_RELEASE);
+}
+
+/* Function to probe the slots of a stripe for a name, the probed slots are added to probes.
+ * It takes no lock, every probe reads a slot once and the slots are never more than half full */
+static struct symbols_table *probe_symbol(const struct symbol_slots *slots, const char *symbol_name, int length,
+                                          unsigned long hash, long *probes) {
+    struct symbols_table *symbol;
+    unsigned long slot;
+
+    if (slots == NULL) {
+        return NULL;
+    }
+
+    /* Probe until an empty slot, comparing names only when the hashes match */
+    slot = (hash / SYMBOL_STRIPES) & (slots->capacity - 1);
+    while ((symbol = __atomic_load_n(&slots->slots[slot], __ATOMIC_ACQUIRE)) != NULL) {
+        (*probes)++;
+        if (symbol->name_hash == hash && strncmp(symbol->symbol_name, symbol_name, length) == 0 && symbol->symbol_name[length] == '\0') {
+            return symbol;
+        }
+        slot = (slot + 1) & (slots->capacity - 1);
+    }
+    return NULL;
+}
+
+/* Function to define a symbol, the check for an existing symbol and the insert are one step under the lock of its stripe.
+ * A label declared by .entry becomes an entry symbol when it is defined, and a defined label becomes one when
+ * .entry declares it, these promotions change the symbol in place under the same lock.
+ * Any other existing symbol is left as it is and returned with symbol_exists */
+symbol_definition define_symbol(struct symbol_table *table, const char *symbol_name, int name_length, enum Symbol type,
+                                int address, int line_number, int data_size, long *probes, struct symbols_table **symbol) {
+    struct symbol_stripe *stripe;
+    struct symbol_slots *slots;
+    struct symbols_table *current_symbol;
+    symbol_definition definition = symbol_exists;
+    unsigned long hash;
+    int i;
+
+    hash = hash_name(symbol_name, name_length);
+    stripe = &table->stripes[hash % SYMBOL_STRIPES];
+    pthread_mutex_lock(&stripe->lock);
+
+    current_symbol = probe_symbol(stripe->slots, symbol_name, name_length, hash, probes);
+    if (current_symbol == NULL) {
+        current_symbol = new_symbol(table);
+        memcpy(current_symbol->symbol_name, symbol_name, name_length);
+        current_symbol->symbol_name[name_length] = '\0';
+        current_symbol->symbol_type = type;
+        current_symbol->symbol_address = address;
+        current_symbol->line_number = line_number;
+        current_symbol->constant_value = 0;
+        current_symbol->data_size = data_size;
+        current_symbol->name_hash = hash;
+        current_symbol->external_index = NOT_FOUND;
+        definition = symbol_added;
+
+        /* Keep the slots at most half full, a larger copy replaces them before the new symbol is published */
+        if ((stripe->size + 1) * 2 > (stripe->slots != NULL ? stripe->slots->capacity : 0)) {
+            slots = new_symbol_slots(stripe->slots != NULL ? stripe->slots->capacity * 2 : MIN_INDEX_CAPACITY);
+            if (stripe->slots != NULL) {
+                for (i = 0; i < stripe->slots->capacity; i++) {
+                    if (stripe->slots->slots[i] != NULL) {
+                        publish_symbol(slots, stripe->slots->slots[i]);
+                    }
+                }
+            }
+            slots->retired = stripe->slots;
+            __atomic_store_n(&stripe->slots, slots, __ATOMIC_RELEASE);
+        }
+        publish_symbol(stripe->slots, current_symbol);
+        stripe->size++;
+    } else if (current_symbol->symbol_type == temp_entry_symbol && (type == Symbol_code || type == Symbol_data)) {
+        /* The label was declared by .entry before its definition */
+        current_symbol->symbol_type = type == Symbol_code ? entry_symbol_code : entry_symbol_data;
+        current_symbol->symbol_address = address;
+        current_symbol->line_number = line_number;
+        definition = symbol_promoted;
+    } else if (type == temp_entry_symbol && (current_symbol->symbol_type == Symbol_code || current_symbol->symbol_type == Symbol_data)) {
+        /* The label was defined before its .entry declaration */
+        current_symbol->symbol_type = current_symbol->symbol_type == Symbol_code ? entry_symbol_code : entry_symbol_data;
+        definition = symbol_promoted;
+    }
+
+    pthread_mutex_unlock(&stripe->lock);
+    *symbol = current_symbol;
+    return definition;
+}
+
+/* Function to add a symbol to the symbol table of a unit, see define_symbol */
+symbol_definition add_symbol(struct AssemblyUnit *unit, const char *symbol_name, int name_length, enum Symbol type,
+                             int address, int line_number, int data_size, struct symbols_table **symbol) {
+    /* The search for an existing symbol is counted as a lookup */
+    unit->symbol_lookups++;
+    return define_symbol(&unit->symbols, symbol_name, name_length, type, address, line_number, data_size, &unit->symbol_probes, symbol);
 }
 
 /* Function to adjust symbol addresses after code generation */
@@ -117,33 +556,170 @@ void adjust_symbol_address(struct symbols_table *symbol, int instruction_counter
 /* Function to add entry symbols to the entries list */
 void add_to_entries(struct AssemblyUnit *Unit, struct symbols_table *symbol) {
     if (symbol->symbol_type == entry_symbol_code || symbol->symbol_type == entry_symbol_data) {
+        Unit->entries = grow_array(Unit->entries, &Unit->entries_capacity, Unit->entries_count + 1, sizeof(*Unit->entries));
         Unit->entries[Unit->entries_count] = symbol;
         Unit->entries_count++;
     }
 }
 
 /* Function to search for a symbol in the symbol table */
-struct symbols_table *search_symbol(struct AssemblyUnit *unit, char *symbol_name) {
-    int i;
-    for (i = 0; i < unit->symbols_size; i++) {
-        if (strcmp(unit->symbols[i].symbol_name, symbol_name) == 0) {
-            return &unit->symbols[i];
-        }
-    }
-    return NULL;
+struct symbols_table *search_symbol(struct AssemblyUnit *unit, const char *symbol_name) {
+    return search_symbol_span(unit, symbol_name, strlen(symbol_name));
+}
+
+/* Function to search for a symbol whose name is given as a span of text */
+struct symbols_table *search_symbol_span(struct AssemblyUnit *unit, const char *symbol_name, int length) {
+    /* Lookups and probed slots are counted for the statistics of the file */
+    unit->symbol_lookups++;
+    return lookup_symbol_span(unit, symbol_name, length, &unit->symbol_probes);
+}
+
+/* Function to search for a symbol without changing the unit, the probed slots are added to probes.
+ * It takes no lock, so several threads can look symbols up at once, even while others add symbols.
+ * The fields a definition may promote are only safe to read once the definitions are over, as in the second stage */
+struct symbols_table *lookup_symbol_span(struct AssemblyUnit *unit, const char *symbol_name, int length, long *probes) {
+    unsigned long hash = hash_name(symbol_name, length);
+    const struct symbol_stripe *stripe = &unit->symbols.stripes[hash % SYMBOL_STRIPES];
+
+    return probe_symbol(__atomic_load_n(&stripe->slots, __ATOMIC_ACQUIRE), symbol_name, length, hash, probes);
 }
 
 /* Function to search for an external symbol in the external symbols table */
 struct external_symbols_table *search_external_symbol(struct AssemblyUnit *unit, char *external_name) {
-    int i;
-    for (i = 0; i < unit->externals_size; i++) {
-        if (strcmp(external_name, unit->externals[i].external_symbol_name) == 0) {
-            return &unit->externals[i];
-        }
+    struct symbols_table *symbol = search_symbol(unit, external_name);
+    if (symbol != NULL && symbol->external_index != NOT_FOUND) {
+        return &unit->externals[symbol->external_index];
     }
     return NULL;
 }
 
+/* Function to add a new external symbol with no references yet */
+struct external_symbols_table *add_external_symbol(struct AssemblyUnit *unit, char *external_name) {
+    struct external_symbols_table *external;
+    struct symbols_table *symbol;
+    unit->externals = grow_array(unit->externals, &unit->externals_capacity, unit->externals_size + 1, sizeof(*unit->externals));
+    external = &unit->externals[unit->externals_size];
+    external->external_symbol_name = external_name;
+    external->external_symbol_addresses = NULL;
+    external->address_count = 0;
+    external->address_capacity = 0;
+
+    /* Link the symbol to its externals entry so it can be found without a scan */
+    symbol = search_symbol(unit, external_name);
+    if (symbol != NULL) {
+        symbol->external_index = unit->externals_size;
+    }
+    unit->externals_size++;
+    return external;
+}
+
+/* Function to record a reference address of an external symbol */
+void add_external_address(struct external_symbols_table *external, int address) {
+    external->external_symbol_addresses = grow_array(external->external_symbol_addresses, &external->address_capacity,
+                                                     external->address_count + 1, sizeof(*external->external_symbol_addresses));
+    external->external_symbol_addresses[external->address_count++] = address;
+}
+
+/* Diagnostics functions */
+
+/* Key of the diagnostics buffer of the file assembled by the calling thread */
+static pthread_key_t diagnostics_key;
+static pthread_once_t diagnostics_key_once = PTHREAD_ONCE_INIT;
+
+/* Function to create the thread-specific diagnostics key, runs once */
+static void create_diagnostics_key(void) {
+    pthread_key_create(&diagnostics_key, NULL);
+}
+
+/* Function to route the diagnostics of the calling thread to a buffer, NULL prints them directly */
+void set_thread_diagnostics(struct diagnostics *diagnostics) {
+    pthread_once(&diagnostics_key_once, create_diagnostics_key);
+    pthread_setspecific(diagnostics_key, diagnostics);
+}
+
+/* Function to append text to the last segment of a diagnostics buffer, or to a new segment for another stream */
+static void append_diagnostic_text(struct diagnostics *diagnostics, FILE *stream, const char *text, int length) {
+    struct diagnostic_segment *segment;
+
+    /* Extend the last segment when it goes to the same stream */
+    segment = diagnostics->segments_count > 0 ? &diagnostics->segments[diagnostics->segments_count - 1] : NULL;
+    if (segment == NULL || segment->stream != stream) {
+        diagnostics->segments = grow_array(diagnostics->segments, &diagnostics->segments_capacity,
+                                           diagnostics->segments_count + 1, sizeof(*diagnostics->segments));
+        segment = &diagnostics->segments[diagnostics->segments_count++];
+        segment->stream = stream;
+        segment->offset = diagnostics->text_size;
+        segment->length = 0;
+    }
+    diagnostics->text = grow_array(diagnostics->text, &diagnostics->text_capacity,
+                                   diagnostics->text_size + length, sizeof(*diagnostics->text));
+    memcpy(diagnostics->text + diagnostics->text_size, text, length);
+    diagnostics->text_size += length;
+    segment->length += length;
+}
+
+/* Function to get the diagnostics buffer of the calling thread, NULL when it prints them directly */
+struct diagnostics *get_thread_diagnostics(void) {
+    pthread_once(&diagnostics_key_once, create_diagnostics_key);
+    return pthread_getspecific(diagnostics_key);
+}
+
+/* Function to report a diagnostic message, buffered when the calling thread assembles a file in a worker */
+void report(FILE *stream, const char *format, ...) {
+    struct diagnostics *diagnostics;
+    char message[MAX_MESSAGE_LENGTH];
+    int length;
+    va_list arguments;
+
+    diagnostics = get_thread_diagnostics();
+
+    va_start(arguments, format);
+    if (diagnostics == NULL) {
+        /* Flushed at once like a buffered segment, so stdout and stderr interleave the same way with --jobs */
+        vfprintf(stream, format, arguments);
+        va_end(arguments);
+        fflush(stream);
+        return;
+    }
+    length = vsnprintf(message, sizeof(message), format, arguments);
+    va_end(arguments);
+    if (length < 0) {
+        return;
+    }
+    if (length >= (int)sizeof(message)) {
+        length = sizeof(message) - 1;
+    }
+    append_diagnostic_text(diagnostics, stream, message, length);
+}
+
+/* Function to report diagnostic text that was already formatted, it goes where report would send it */
+void report_text(FILE *stream, const char *text, int length) {
+    struct diagnostics *diagnostics = get_thread_diagnostics();
+
+    if (diagnostics == NULL) {
+        fwrite(text, 1, length, stream);
+        fflush(stream);
+        return;
+    }
+    append_diagnostic_text(diagnostics, stream, text, length);
+}
+
+/* Function to print buffered diagnostics to their streams in the order they were reported */
+void flush_diagnostics(struct diagnostics *diagnostics) {
+    int i;
+    for (i = 0; i < diagnostics->segments_count; i++) {
+        fwrite(diagnostics->text + diagnostics->segments[i].offset, 1, diagnostics->segments[i].length, diagnostics->segments[i].stream);
+        fflush(diagnostics->segments[i].stream);
+    }
+}
+
+/* Function to release the memory of a diagnostics buffer */
+void free_diagnostics(struct diagnostics *diagnostics) {
+    free(diagnostics->text);
+    free(diagnostics->segments);
+    memset(diagnostics, 0, sizeof(*diagnostics));
+}
+
 /* File handling functions */
 
 /* Function to strip input file prefixes from filename */
@@ -178,28 +754,7 @@ FILE* createFile(const char* filepath) {
     
     file = fopen(filepath, "w");
     if (file == NULL) {
-        fprintf(stderr, "[ERROR] Unable to create file: %s\n", filepath);
+        report(stderr, "[ERROR] Unable to create file: %s\n", filepath);
     }
     return file;
-}
-
-/* Function to write an instruction to the output file */
-int writeInstruction(FILE* file, int address, int instruction) {
-    if (!file) {
-        fprintf(stderr, "Error: Null file pointer passed to writeInstruction\n");
-        return ERROR;
-    }
-
-    if (fprintf(file, "%04d %d%d%d%d%d\n",
-                address,
-                (instruction >> 12) & 0x7,
-                (instruction >> 9) & 0x7,
-                (instruction >> 6) & 0x7,
-                (instruction >> 3) & 0x7,
-                instruction & 0x7) < 0) {
-        fprintf(stderr, "Error: Failed to write instruction to file\n");
-        return ERROR;
-    }
-
-    return 0;
 }
\ No newline at end of file
@@ -10,12 +10,19 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+/* Expose the POSIX interfaces (strtok_r, snprintf) under -ansi */
+#define _POSIX_C_SOURCE 200809L
+
 /* Included necessary libraries */
 #include <ctype.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include <stdint.h>
 
 /* Global definition used across the entire process */
 #define WHITESPACE  " \t\f\r\v"
@@ -36,19 +43,31 @@
 #define MAX_EXTERNAL_ADDRESSES 100
 #define NUMBER_OF_DIRECTIVES 4
 #define NUMBER_OF_OPCODES 16
+#define NUMBER_OF_KEYWORDS 31
+#define NUMBER_OF_MODES 5
+#define KEYWORD_SLOTS 64
+#define MIN_KEYWORD_LENGTH 2
+#define MAX_KEYWORD_LENGTH 7
 #define MIN_NUM_RANGE -2048
 #define MAX_NUM_RANGE 2047
 #define MIN_DATA_RANGE -8192
 #define MAX_DATA_RANGE 8191
 #define MAX_SIZE 4096  
-#define MAX_LINES 10
 #define MAX_LENGTH 82
-#define MAX_MAC_FOUND 1000
+#define MAX_LINE_LENGTH 80
 #define INIT_ADDRESS 100  
+#define NOT_FOUND -1
+#define MIN_INDEX_CAPACITY 64
+#define MIN_CHUNK_LINES 1024
+#define SYMBOL_STRIPES 16
+#define SYMBOL_BLOCK_SIZE 256
+#define HASH_SEED 2166136261UL
+#define ASSEMBLER_VERSION "1.17"
 #define MACRO_MAX_SIZE 32
 #define MODE_WRITE "w"
 #define MODE_READ "r"
 #define OBJ_FILE_TYPE ".ob"
+#define BINARY_OBJ_FILE_TYPE ".obin"
 #define ENT_FILE_TYPE ".ent"
 #define EXT_FILE_TYPE ".ext"
 #define INPUT_FILE_EXT ".as"
@@ -62,9 +81,20 @@
 #define IMMEDIATE_VAL '#'
 #define OUTPUT_FILE_DIR "output_files"
 #define MAX_PATH_LENGTH 256
+#define WORD_MASK 0x7FFF
+#define NUMBER_OF_WORDS 32768
+#define OCTAL_WORD_DIGITS 5
+#define ADDRESS_DIGITS 4
+#define OBJECT_LINE_LENGTH 11
+#define MAX_OBJECT_HEADER_LENGTH 32
+#define MAX_MESSAGE_LENGTH 1024
 #define INPUT_FILES_PREFIX_1 "input_files\\"
 #define INPUT_FILES_PREFIX_2 "input_files/"
 
+/* Macro to pack a value into a machine word, keeping its low 15 bits in two's complement.
+ * Every word stored in the code and data images or in the line records goes through it */
+#define TO_WORD(value) ((uint16_t)((value) & WORD_MASK))
+
 /* Enum to define different types of symbols */
 enum Symbol {
     Symbol_code,          
@@ -83,46 +113,198 @@ struct symbols_table  {
     int line_number;                
     int constant_value;             
     int data_size;                 
+    unsigned long name_hash;
+    int external_index;
+};
+
+/* Structure holding the open addressing slots of a stripe of the symbol table.
+ * A stripe that outgrows its slots publishes a larger copy, the copies it replaced are
+ * kept until the table is released since lookups may still be reading them */
+struct symbol_slots {
+    struct symbols_table **slots;
+    int capacity;
+    struct symbol_slots *retired;
+};
+
+/* Structure representing a stripe of the symbol table, the names whose hash falls in it are inserted under its lock */
+struct symbol_stripe {
+    pthread_mutex_t lock;
+    struct symbol_slots *slots;
+    int size;
 };
 
+/* Structure representing the symbol table, several threads can insert into it and look symbols up at once.
+ * Inserts lock the stripe of the name, lookups take no lock and only read the slots published by the inserts.
+ * A symbol found while others are defined has a stable name, its type, address and line may still be promoted
+ * under the stripe lock, so they are read without it only once the definitions are over.
+ * The symbols are stored in blocks that never move, in the order they were added */
+struct symbol_table {
+    struct symbol_stripe stripes[SYMBOL_STRIPES];
+    pthread_mutex_t storage_lock;
+    struct symbols_table **blocks;
+    int blocks_count;
+    int blocks_capacity;
+    int size;
+};
+
+/* Enumeration for the outcome of adding a symbol to the symbol table */
+typedef enum symbol_definition {
+    symbol_added,
+    symbol_promoted,
+    symbol_exists
+} symbol_definition;
+
 /* Structure representing an external symbol and its addresses */
 struct external_symbols_table {
     char * external_symbol_name;               
-    int external_symbol_addresses[MAX_SIZE];    
+    int *external_symbol_addresses;    
     int address_count;                        
+    int address_capacity;
+};
+
+/* Structure representing an analyzed code or data line, kept by the first stage for the second stage */
+struct line_record {
+    int line_number;
+    int word_offset;
+    unsigned char line_type;
+    unsigned char opcode;
+    unsigned char operand_type[2];
+    short operand_value[2];
+    int label_offset[2];
+    int payload_offset;
+    int payload_size;
+};
+
+/* Structure holding the analyzed lines of a file, the pool of referenced label names
+ * and the pool of .data/.string payload words that the records point into */
+struct line_records_table {
+    struct line_record *records;
+    int records_size;
+    int records_capacity;
+    char *names;
+    int names_size;
+    int names_capacity;
+    uint16_t *payload;
+    int payload_size;
+    int payload_capacity;
+};
+
+/* Structure holding the macro-expanded source of a file in memory.
+ * line_offsets holds the start of every line in text, with a final entry at the end of the text. */
+struct source_buffer {
+    char *text;
+    int text_size;
+    int text_capacity;
+    int *line_offsets;
+    int lines_count;
+    int lines_capacity;
+};
+
+/* Structure representing a source file mapped into memory, the start of every line is found in a single scan.
+ * line_offsets holds the start of every line in text, with a final entry at the end of the text.
+ * The text is read only and isn't null terminated, every line is a span of it. */
+struct mapped_source {
+    const char *text;
+    int size;
+    int *line_offsets;
+    int lines_count;
+    int lines_capacity;
+};
+
+/* Structure holding the command-line options of the assembler */
+struct assembler_options {
+    bool write_am;
+    bool binary_object;
+    char *cache_dir;
+    int jobs;
+    int stats;
+    char *stats_path;
+    bool hardware_counters;
+};
+
+/* Structure representing a run of diagnostic text written to the same output stream */
+struct diagnostic_segment {
+    FILE *stream;
+    int offset;
+    int length;
+};
+
+/* Structure holding the diagnostics reported while assembling one file, so they can be printed later in order */
+struct diagnostics {
+    char *text;
+    int text_size;
+    int text_capacity;
+    struct diagnostic_segment *segments;
+    int segments_count;
+    int segments_capacity;
 };
 
-/* Structure representing the entire assembly unit, including code, data, symbols, and entries */
+/* Structure representing the entire assembly unit, including code, data, symbols, and entries.
+ * Every table is a growable heap buffer, so a unit costs memory in proportion to the program. */
 struct AssemblyUnit {
-    int code[MAX_SIZE];           
+    uint16_t *code;           
     int code_size;                 
-    int data[MAX_SIZE];          
+    int code_capacity;
+    uint16_t *data;          
     int data_size;               
-    struct symbols_table symbols[MAX_SIZE]; 
-    int symbols_size;                      
-    const struct symbols_table *entries[MAX_SIZE];  
+    int data_capacity;
+    struct symbol_table symbols; 
+    long symbol_lookups;
+    long symbol_probes;
+    const struct symbols_table **entries;  
     int entries_count;                              
-    struct external_symbols_table externals[MAX_SIZE];  
+    int entries_capacity;
+    struct external_symbols_table *externals;  
     int externals_size;                               
+    int externals_capacity;
+    struct line_records_table lines;
 };
 
 /* Function prototypes */
-char* preProcessor(const char* inputFilename);
-int firstStage(struct AssemblyUnit* unit, FILE *AMFILE, char *AMFILENAME);
-int secondStage(struct AssemblyUnit* unit, FILE* AMFILE, char *AMFILENAME);
+char* preProcessor(const char* inputFilename, struct source_buffer *expanded, bool write_am);
+int firstStage(struct AssemblyUnit* unit, const struct source_buffer *expanded, char *AMFILENAME, int jobs);
+int secondStage(struct AssemblyUnit* unit, char *AMFILENAME, int jobs);
 int create_entry_file(const struct symbols_table * const items[], const int size_items, char *name_b);
 int create_external_file(const struct external_symbols_table *params, const int size_params, char *name_b);
-int create_object_file(const int *code, const int code_size, const int *data, const int data_size, char *origin_name);
-void add_symbol(struct AssemblyUnit *unit, char *symbol_name, enum Symbol type, int address, int line_number, int const_value, int data_size);
-void update_symbol(struct symbols_table *symbol, int line_counter, int address, enum Symbol type);
-void update_entry_symbol(struct symbols_table *symbol, const char *file_name, int line_counter);
+int create_object_file(const uint16_t *code, const int code_size, const uint16_t *data, const int data_size, char *origin_name);
+int create_binary_object_file(const struct AssemblyUnit *unit, char *origin_name);
+void init_assembly_unit(struct AssemblyUnit *unit);
+void free_assembly_unit(struct AssemblyUnit *unit);
+void reserve_unit_images(struct AssemblyUnit *unit, int code_words, int data_words);
+void *grow_array(void *array, int *capacity, int required, size_t element_size);
+void append_source_text(struct source_buffer *source, const char *text, int length);
+void index_source_lines(struct source_buffer *source, int max_line_length);
+void free_source_buffer(struct source_buffer *source);
+int map_source_file(const char *path, struct mapped_source *source);
+void unmap_source_file(struct mapped_source *source);
+struct line_record *add_line_record(struct AssemblyUnit *unit, int line_number);
+int add_line_name(struct line_records_table *lines, const char *name, int length);
+int add_line_payload(struct line_records_table *lines, const uint16_t *values, int count);
+unsigned long hash_name(const char *name, int length);
+unsigned long hash_bytes(unsigned long hash, const char *bytes, long length);
+void init_symbol_table(struct symbol_table *table);
+void free_symbol_table(struct symbol_table *table);
+struct symbols_table *symbol_at(const struct symbol_table *table, int index);
+symbol_definition define_symbol(struct symbol_table *table, const char *symbol_name, int name_length, enum Symbol type,
+                                int address, int line_number, int data_size, long *probes, struct symbols_table **symbol);
+symbol_definition add_symbol(struct AssemblyUnit *unit, const char *symbol_name, int name_length, enum Symbol type,
+                             int address, int line_number, int data_size, struct symbols_table **symbol);
 void adjust_symbol_address(struct symbols_table *symbol, int instruction_counter);
 void add_to_entries(struct AssemblyUnit *Unit, struct symbols_table *symbol);
-struct symbols_table * search_symbol(struct AssemblyUnit * unit, char * name);
+struct symbols_table * search_symbol(struct AssemblyUnit * unit, const char * name);
+struct symbols_table * search_symbol_span(struct AssemblyUnit * unit, const char * name, int length);
+struct symbols_table * lookup_symbol_span(struct AssemblyUnit * unit, const char * name, int length, long * probes);
 struct external_symbols_table * search_external_symbol(struct AssemblyUnit * unit, char * name);
+struct external_symbols_table * add_external_symbol(struct AssemblyUnit * unit, char * name);
+void add_external_address(struct external_symbols_table *external, int address);
+void report(FILE *stream, const char *format, ...);
+void set_thread_diagnostics(struct diagnostics *diagnostics);
+struct diagnostics *get_thread_diagnostics(void);
+void report_text(FILE *stream, const char *text, int length);
+void flush_diagnostics(struct diagnostics *diagnostics);
+void free_diagnostics(struct diagnostics *diagnostics);
 const char* stripInputFilesPrefix(const char* filename);
 char* getFilePath(const char* dir, const char* filename, const char* extension);
 FILE* createFile(const char* filepath);
-int writeInstruction(FILE* file, int address, int instruction);
 
 #endif
@@ -0,0 +1,290 @@
+/*
+ * This file implements the worker pool that assembles several files concurrently.
+ * Workers take the next file from a shared counter and assemble it with the
+ * diagnostics of their thread routed to the file's buffer, while the calling
+ * thread prints the buffers in command-line order as soon as each file is done.
+ * A file split in chunks pushes them on the deque of its worker with run_tasks. The worker
+ * pops its own chunks newest first, while the others steal them oldest first when they have
+ * no file left to take, so one large file among small ones keeps every worker busy to the end.
+ * The time each worker spends waiting for work is reported with the statistics of the run.
+ */
+
+#include "worker_pool.h"
+
+/* Key of the worker running on the calling thread, NULL outside the pool */
+static pthread_key_t worker_key;
+static pthread_once_t worker_key_once = PTHREAD_ONCE_INIT;
+
+/* Function to create the thread-specific worker key, runs once */
+static void create_worker_key(void) {
+    pthread_key_create(&worker_key, NULL);
+}
+
+/* Function to push a task at the bottom of a deque */
+static void push_task(struct task_deque *deque, const struct chunk_task *task) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom == deque->capacity && deque->top > 0) {
+        /* Reuse the room left by the stolen tasks before growing */
+        memmove(deque->tasks, deque->tasks + deque->top, (deque->bottom - deque->top) * sizeof(*deque->tasks));
+        deque->bottom -= deque->top;
+        deque->top = 0;
+    }
+    deque->tasks = grow_array(deque->tasks, &deque->capacity, deque->bottom + 1, sizeof(*deque->tasks));
+    deque->tasks[deque->bottom++] = *task;
+    pthread_mutex_unlock(&deque->lock);
+}
+
+/* Function to take a task from a deque, the newest one for its owner and the oldest one for a thief.
+ * Returns false when the deque is empty */
+static bool take_task(struct task_deque *deque, struct chunk_task *task, bool steal) {
+    bool taken;
+
+    pthread_mutex_lock(&deque->lock);
+    taken = deque->bottom > deque->top;
+    if (taken) {
+        *task = steal ? deque->tasks[deque->top++] : deque->tasks[--deque->bottom];
+        if (deque->top == deque->bottom) {
+            deque->top = deque->bottom = 0;
+        }
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return taken;
+}
+
+/* Function to run a queued task, from the worker's own deque or, when steal is set, stolen from another worker.
+ * Returns false when no task could be taken */
+static bool run_queued_task(struct worker *worker, bool steal) {
+    struct worker_pool *pool = worker->pool;
+    struct chunk_task task;
+    struct phase_mark mark;
+    bool stolen = false;
+    int i;
+
+    if (!take_task(&worker->deque, &task, false)) {
+        if (!steal) {
+            return false;
+        }
+        for (i = 1; i < pool->workers_count && !stolen; i++) {
+            stolen = take_task(&pool->workers[(worker->index + i) % pool->workers_count].deque, &task, true);
+        }
+        if (!stolen) {
+            return false;
+        }
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->queued_tasks--;
+    pthread_mutex_unlock(&pool->lock);
+
+    /* A stolen task is measured on this thread and credited to its file, the owner's counters don't see it */
+    if (stolen && task.stats != NULL) {
+        start_task_counts(&worker->task_counters, &mark);
+    }
+    task.function(task.argument);
+    if (stolen && task.stats != NULL) {
+        credit_task_counts(&worker->task_counters, &mark, task.stats);
+    }
+    worker->stats.tasks++;
+    worker->stats.stolen += stolen;
+
+    /* The worker waiting for the task's group may be asleep */
+    pthread_mutex_lock(&pool->lock);
+    (*task.pending)--;
+    pthread_cond_broadcast(&pool->work_changed);
+    pthread_mutex_unlock(&pool->lock);
+    return true;
+}
+
+/* Function to wait for the work of the pool to change, the pool lock is held. The wait is idle time of the worker */
+static void wait_for_work(struct worker *worker) {
+    double start = stats_clock();
+
+    pthread_cond_wait(&worker->pool->work_changed, &worker->pool->lock);
+    worker->idle_seconds += stats_clock() - start;
+}
+
+/* Function to run a function on every element of an array and return once all are done.
+ * On a worker of the pool the elements after the first are queued as tasks other workers can steal,
+ * and the worker runs the ones left in its own deque, then waits for the stolen ones. It never runs the
+ * chunks of another file meanwhile, so the phase of the calling file measures its own work alone.
+ * Elsewhere the elements run one after another.
+ * A stolen task runs with the diagnostics and statistics of the thief's own file, so the function must not
+ * report or count anything, it leaves its results in its element for the caller to report after the call */
+void run_tasks(void *(*function)(void *), void *elements, int count, size_t element_size) {
+    struct worker *worker;
+    struct chunk_task task;
+    int pending = count - 1;
+    int i;
+
+    pthread_once(&worker_key_once, create_worker_key);
+    worker = pthread_getspecific(worker_key);
+    if (worker == NULL || count == 1) {
+        for (i = 0; i < count; i++) {
+            function((char *)elements + i * element_size);
+        }
+        return;
+    }
+
+    /* Queue the last elements first, so the owner pops them in order and thieves take the last ones */
+    task.function = function;
+    task.pending = &pending;
+    task.stats = get_thread_stats();
+    for (i = count - 1; i > 0; i--) {
+        task.argument = (char *)elements + i * element_size;
+        push_task(&worker->deque, &task);
+    }
+    pthread_mutex_lock(&worker->pool->lock);
+    worker->pool->queued_tasks += count - 1;
+    pthread_cond_broadcast(&worker->pool->work_changed);
+    pthread_mutex_unlock(&worker->pool->lock);
+
+    function(elements);
+
+    /* Run the tasks no one stole, only this worker pushes to its deque so it stays empty once drained */
+    while (run_queued_task(worker, false));
+
+    /* Wait for the stolen tasks to be done */
+    pthread_mutex_lock(&worker->pool->lock);
+    while (pending > 0) {
+        wait_for_work(worker);
+    }
+    pthread_mutex_unlock(&worker->pool->lock);
+}
+
+/* Function to assemble the given files on options->jobs worker threads */
+int run_worker_pool(char **filenames, int files_count, const struct assembler_options *options) {
+    struct worker_pool pool;
+    pthread_t *threads;
+    int started = 0;
+    int result = 0;
+    int i;
+
+    pool.jobs = calloc(files_count, sizeof(*pool.jobs));
+    pool.workers_count = options->jobs;
+    pool.workers = calloc(pool.workers_count, sizeof(*pool.workers));
+    threads = malloc(pool.workers_count * sizeof(*threads));
+    if (pool.jobs == NULL || pool.workers == NULL || threads == NULL) {
+        fprintf(stderr, "[ERROR] Out of memory, aborting.\n");
+        exit(1);
+    }
+    for (i = 0; i < files_count; i++) {
+        pool.jobs[i].filename = filenames[i];
+    }
+    pool.jobs_count = files_count;
+    pool.next_job = 0;
+    pool.running_jobs = 0;
+    pool.queued_tasks = 0;
+    pool.options = options;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.job_done, NULL);
+    pthread_cond_init(&pool.work_changed, NULL);
+    for (i = 0; i < pool.workers_count; i++) {
+        pool.workers[i].pool = &pool;
+        pool.workers[i].index = i;
+        pthread_mutex_init(&pool.workers[i].deque.lock, NULL);
+    }
+
+    /* Start the workers, assemble on this thread alone if none could be started */
+    pool.start = stats_clock();
+    for (i = 0; i < pool.workers_count; i++) {
+        pool.workers[i].started = pthread_create(&threads[i], NULL, worker_main, &pool.workers[i]) == 0;
+        started += pool.workers[i].started;
+    }
+    if (started == 0) {
+        pool.workers[0].started = true;
+        worker_main(&pool.workers[0]);
+    }
+
+    /* Print the diagnostics of every file in order, as soon as it is done */
+    for (i = 0; i < files_count; i++) {
+        pthread_mutex_lock(&pool.lock);
+        while (!pool.jobs[i].done) {
+            pthread_cond_wait(&pool.job_done, &pool.lock);
+        }
+        pthread_mutex_unlock(&pool.lock);
+
+        flush_diagnostics(&pool.jobs[i].diagnostics);
+        free_diagnostics(&pool.jobs[i].diagnostics);
+        if (pool.jobs[i].result != 0) {
+            result = ERROR;
+        }
+    }
+
+    for (i = 0; i < pool.workers_count; i++) {
+        if (pool.workers[i].started && started > 0) {
+            pthread_join(threads[i], NULL);
+        }
+    }
+
+    /* Every worker is measured against the whole run of the pool */
+    for (i = 0; i < pool.workers_count; i++) {
+        if (pool.workers[i].started) {
+            pool.workers[i].stats.seconds = stats_clock() - pool.start;
+            record_worker_stats(&pool.workers[i].stats);
+        }
+        free(pool.workers[i].deque.tasks);
+        pthread_mutex_destroy(&pool.workers[i].deque.lock);
+    }
+
+    pthread_cond_destroy(&pool.work_changed);
+    pthread_cond_destroy(&pool.job_done);
+    pthread_mutex_destroy(&pool.lock);
+    free(threads);
+    free(pool.workers);
+    free(pool.jobs);
+    return result;
+}
+
+/* Function run by every worker thread, assembles files and runs the chunks of other files until no work is left */
+void *worker_main(void *worker_pointer) {
+    struct worker *worker = worker_pointer;
+    struct worker_pool *pool = worker->pool;
+    struct file_job *job;
+
+    pthread_once(&worker_key_once, create_worker_key);
+    pthread_setspecific(worker_key, worker);
+    init_file_stats(&worker->task_counters, NULL, pool->options->hardware_counters);
+
+    while (1) {
+        /* Chunks already queued come first, they hold back a file that started earlier */
+        if (run_queued_task(worker, true)) {
+            continue;
+        }
+
+        /* Take the next file, or wait while the files still running may queue chunks */
+        pthread_mutex_lock(&pool->lock);
+        if (pool->next_job >= pool->jobs_count) {
+            if (pool->running_jobs == 0 && pool->queued_tasks == 0) {
+                pthread_mutex_unlock(&pool->lock);
+                break;
+            }
+            if (pool->queued_tasks == 0) {
+                wait_for_work(worker);
+            }
+            pthread_mutex_unlock(&pool->lock);
+            continue;
+        }
+        job = &pool->jobs[pool->next_job++];
+        pool->running_jobs++;
+        pthread_mutex_unlock(&pool->lock);
+
+        /* Assemble it with the diagnostics of this thread buffered in the job */
+        set_thread_diagnostics(&job->diagnostics);
+        job->result = process_file(job->filename, pool->options);
+        set_thread_diagnostics(NULL);
+        worker->stats.files++;
+
+        pthread_mutex_lock(&pool->lock);
+        job->done = true;
+        pool->running_jobs--;
+        pthread_cond_broadcast(&pool->job_done);
+        pthread_cond_broadcast(&pool->work_changed);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    /* The worker was busy from the start of the pool to now, but for its waits */
+    worker->stats.busy_seconds = stats_clock() - pool->start - worker->idle_seconds;
+    close_file_stats(&worker->task_counters);
+    pthread_setspecific(worker_key, NULL);
+    return NULL;
+}
@@ -0,0 +1,78 @@
+/*
+ * This header file declares the worker pool that assembles several files concurrently.
+ * Workers take whole files from a shared queue, their diagnostics are buffered and printed
+ * in the order the files were given on the command line. The chunks of a large file are
+ * tasks of their own, kept in the deque of the worker assembling it, so workers that run
+ * out of files steal them instead of waiting for the large file to finish.
+ */
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+/* Included necessary header files */
+#include "main.h"
+#include "stats.h"
+
+/* Structure representing one file to assemble and the diagnostics it produced */
+struct file_job {
+    char *filename;
+    struct diagnostics diagnostics;
+    int result;
+    bool done;
+};
+
+/* Structure representing a chunk task, a function run on one chunk of a file, it may run on any worker
+ * and must not report diagnostics. pending counts the unfinished tasks of the run_tasks call it belongs to,
+ * stats are the statistics of the file, credited with the hardware counts of the task when it is stolen */
+struct chunk_task {
+    void *(*function)(void *);
+    void *argument;
+    int *pending;
+    struct file_stats *stats;
+};
+
+/* Structure representing the deque of chunk tasks of a worker.
+ * The worker pushes and pops at the bottom, the workers stealing from it take the oldest task at the top */
+struct task_deque {
+    pthread_mutex_t lock;
+    struct chunk_task *tasks;
+    int top;
+    int bottom;
+    int capacity;
+};
+
+/* Structure representing a worker thread of the pool and the work it did.
+ * task_counters are the hardware counters of the thread that measure the chunks it steals */
+struct worker {
+    struct worker_pool *pool;
+    int index;
+    bool started;
+    struct task_deque deque;
+    double idle_seconds;
+    struct worker_stats stats;
+    struct file_stats task_counters;
+};
+
+/* Structure shared by the workers of the pool.
+ * The counters and the conditions are protected by lock, the deques by their own locks */
+struct worker_pool {
+    struct file_job *jobs;
+    int jobs_count;
+    int next_job;
+    int running_jobs;
+    int queued_tasks;
+    struct worker *workers;
+    int workers_count;
+    double start;
+    const struct assembler_options *options;
+    pthread_mutex_t lock;
+    pthread_cond_t job_done;
+    pthread_cond_t work_changed;
+};
+
+/* Function prototypes */
+int run_worker_pool(char **filenames, int files_count, const struct assembler_options *options);
+void *worker_main(void *worker_pointer);
+void run_tasks(void *(*function)(void *), void *elements, int count, size_t element_size);
+
+#endif